@@ -0,0 +1,196 @@
+/*
+ * Compares the epoll and io_uring drivers by typing lines on many pseudo
+ * terminals at once, one key at a time, and measuring CPU time spent by the
+ * thread running the driver.
+ */
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <peelo/prompt.hpp>
+
+namespace
+{
+  struct terminal
+  {
+    int master;
+    int slave;
+  };
+
+  bool open_terminal(terminal& t)
+  {
+    ::termios attributes;
+    const ::winsize size = { 24, 80, 0, 0 };
+
+    t.master = ::posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (t.master == -1)
+    {
+      return false;
+    }
+    if (::grantpt(t.master) == -1
+        || ::unlockpt(t.master) == -1
+        || (t.slave = ::open(::ptsname(t.master), O_RDWR | O_NOCTTY)) == -1)
+    {
+      ::close(t.master);
+      return false;
+    }
+    ::tcgetattr(t.slave, &attributes);
+    ::cfmakeraw(&attributes);
+    ::tcsetattr(t.slave, TCSANOW, &attributes);
+    ::ioctl(t.slave, TIOCSWINSZ, &size);
+
+    return true;
+  }
+
+  double get_thread_time()
+  {
+    ::timespec ts;
+
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+  /**
+   * Types given number of lines on each terminal, one key of every terminal
+   * at a time, while reading and discarding output of the terminals.
+   */
+  void type_lines(const std::vector<terminal>& terminals,
+                  std::size_t lines,
+                  std::size_t length,
+                  const std::atomic<bool>& done)
+  {
+    char output[65536];
+
+    for (std::size_t i = 0; i < lines * (length + 1); ++i)
+    {
+      const char key = i % (length + 1) == length
+        ? '\r'
+        : static_cast<char>('a' + i % 26);
+
+      for (const auto& t : terminals)
+      {
+        while (::write(t.master, &key, 1) != 1)
+        {
+          while (::read(t.master, output, sizeof(output)) > 0);
+          std::this_thread::yield();
+        }
+      }
+      for (const auto& t : terminals)
+      {
+        while (::read(t.master, output, sizeof(output)) > 0);
+      }
+    }
+    while (!done)
+    {
+      for (const auto& t : terminals)
+      {
+        while (::read(t.master, output, sizeof(output)) > 0);
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  template<class Driver>
+  bool run(const char* name,
+           std::size_t count,
+           std::size_t lines,
+           std::size_t length)
+  {
+    const auto expected = count * lines;
+    std::vector<terminal> terminals(count);
+    std::vector<std::unique_ptr<peelo::prompt>> prompts;
+    std::size_t received = 0;
+    std::atomic<bool> done(false);
+    Driver driver([&](int, const peelo::prompt::value_type& line)
+    {
+      if (line)
+      {
+        ++received;
+      }
+
+      return true;
+    });
+
+    if (!driver.is_open())
+    {
+      std::cout << name << ": not supported" << std::endl;
+
+      return false;
+    }
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      if (!open_terminal(terminals[i]))
+      {
+        std::cerr << "Unable to open pseudo terminal: "
+                  << std::strerror(errno)
+                  << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      prompts.push_back(std::make_unique<peelo::prompt>());
+      driver.add(terminals[i].slave, *prompts.back(), "> ", 80, 24);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto cpu_start = get_thread_time();
+    std::thread typist(type_lines, terminals, lines, length, std::ref(done));
+
+    while (received < expected)
+    {
+      if (driver.run_once(100) == -1)
+      {
+        std::cerr << name << ": " << std::strerror(errno) << std::endl;
+        break;
+      }
+    }
+
+    const auto cpu_time = get_thread_time() - cpu_start;
+    const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    const auto keys = static_cast<double>(expected * (length + 1));
+
+    done = true;
+    typist.join();
+    for (auto& t : terminals)
+    {
+      driver.remove(t.slave);
+      ::close(t.slave);
+      ::close(t.master);
+    }
+
+    std::cout << name << ": "
+              << received << " lines in "
+              << elapsed.count() << " s, "
+              << cpu_time * 1e9 / keys << " ns of CPU time per key"
+              << std::endl;
+
+    return true;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const std::size_t count = argc > 1 ? std::atoi(argv[1]) : 256;
+  const std::size_t lines = argc > 2 ? std::atoi(argv[2]) : 20;
+  const std::size_t length = argc > 3 ? std::atoi(argv[3]) : 20;
+
+  std::cout << count << " terminals, "
+            << lines << " lines of "
+            << length << " keys each" << std::endl;
+  run<peelo::prompt::epoll_driver>("epoll", count, lines, length);
+  run<peelo::prompt::io_uring_driver>("io_uring", count, lines, length);
+
+  return EXIT_SUCCESS;
+}
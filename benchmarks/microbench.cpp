@@ -0,0 +1,530 @@
+/*
+ * Measures cost of individual editing operations by feeding keys to a
+ * session and collecting the output into memory, so that no terminal is
+ * involved. Time, bytes of output and allocations made by the prompt are
+ * reported per operation.
+ *
+ * Name of an operation, or part of it, can be given as argument to run only
+ * the matching operations.
+ *
+ * With --complexity the operations are instead run on input of geometrically
+ * increasing sizes, and growth of the time per operation is fitted to a
+ * power of the size. The program fails if an operation grows faster than
+ * expected, for example when an operation which should take constant or
+ * logarithmic time per key becomes linear.
+ */
+#define PEELO_PROMPT_MAX_LINE (1 << 17)
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include <peelo/prompt.hpp>
+
+namespace
+{
+  /** Number of operations timed at once. */
+  const std::size_t batch_size = 64;
+
+  /** Minimum time spent on measuring each operation. */
+  const std::chrono::milliseconds min_duration(100);
+
+  /** Size of the terminal the session is drawn on. */
+  const std::size_t cols = 80;
+  const std::size_t rows = 24;
+
+  const std::size_t sizes[] = { 1000, 10000, 100000 };
+
+  /** Sizes used for fitting the growth of operations. */
+  const std::size_t complexity_sizes[] =
+  {
+    2000,
+    4000,
+    8000,
+    16000,
+    32000,
+    64000,
+    128000,
+  };
+
+  /**
+   * Memory resource which counts the allocations made through it.
+   */
+  class counting_resource : public std::pmr::memory_resource
+  {
+  public:
+    std::size_t allocations = 0;
+
+  private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+      ++allocations;
+
+      return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p,
+                       std::size_t bytes,
+                       std::size_t alignment) override
+    {
+      std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const memory_resource& that) const noexcept override
+    {
+      return this == &that;
+    }
+  };
+
+  enum class position
+  {
+    start,
+    middle,
+    end
+  };
+
+  /**
+   * Expected growth of the time taken by an operation as the size of the
+   * input grows.
+   */
+  enum class complexity
+  {
+    logarithmic,
+    linear
+  };
+
+  /**
+   * Returns the largest exponent of the size accepted for an operation with
+   * given complexity. Over the sizes used, logarithmic growth has exponent
+   * below 0.2. Cost of dispatching the key and refreshing the screen does
+   * not depend on the size, which pulls the exponent of a linear operation
+   * below one, so the limit for logarithmic operations is kept low.
+   */
+  double max_exponent(complexity expected)
+  {
+    return expected == complexity::logarithmic ? 0.3 : 1.5;
+  }
+
+  /**
+   * Describes an operation being measured. The key is fed to the session
+   * once for every operation, after which the undo key is fed the same
+   * number of times outside of the measurement, so that the size of the
+   * input stays the same. Without a key, the session is told that the
+   * terminal has been resized instead.
+   */
+  struct operation
+  {
+    const char* name;
+    /** Whether the size is number of history entries instead of length of
+     * the input. */
+    bool history;
+    position where;
+    const char* key;
+    const char* undo;
+    /** Edits in the middle of the input move the rest of it, or the words
+     * after it, so they are expected to be linear. */
+    complexity expected;
+  };
+
+  const operation operations[] =
+  {
+    {
+      "insert start",
+      false,
+      position::start,
+      "x",
+      "\b",
+      complexity::linear
+    },
+    {
+      "insert middle",
+      false,
+      position::middle,
+      "x",
+      "\b",
+      complexity::linear
+    },
+    {
+      "insert end",
+      false,
+      position::end,
+      "x",
+      "\b",
+      complexity::logarithmic
+    },
+    {
+      "delete word middle",
+      false,
+      position::middle,
+      "\027",
+      "word ",
+      complexity::linear
+    },
+    {
+      "delete word end",
+      false,
+      position::end,
+      "\027",
+      "word ",
+      complexity::logarithmic
+    },
+    {
+      "transpose middle",
+      false,
+      position::middle,
+      "\024",
+      "\002",
+      complexity::linear
+    },
+    {
+      "move middle",
+      false,
+      position::middle,
+      "\002",
+      "\006",
+      complexity::logarithmic
+    },
+    {
+      "history",
+      true,
+      position::end,
+      "\033[A",
+      "\033[B",
+      complexity::logarithmic
+    },
+    {
+      "redraw start",
+      false,
+      position::start,
+      "\014",
+      "",
+      complexity::logarithmic
+    },
+    {
+      "redraw middle",
+      false,
+      position::middle,
+      "\014",
+      "",
+      complexity::logarithmic
+    },
+    {
+      "redraw end",
+      false,
+      position::end,
+      "\014",
+      "",
+      complexity::logarithmic
+    },
+    // Resizing lays out the whole input again.
+    {
+      "resize start",
+      false,
+      position::start,
+      nullptr,
+      "",
+      complexity::linear
+    },
+    {
+      "resize middle",
+      false,
+      position::middle,
+      nullptr,
+      "",
+      complexity::linear
+    },
+    {
+      "resize end",
+      false,
+      position::end,
+      nullptr,
+      "",
+      complexity::linear
+    },
+  };
+
+  struct result
+  {
+    double ns;
+    double bytes;
+    double allocations;
+  };
+
+  class session
+  {
+  public:
+    session(bool multi_line, std::size_t history)
+      : m_prompt(&m_resource)
+    {
+      m_prompt.set_multi_line(multi_line);
+      m_prompt.set_history_max_size(history + 1);
+      for (std::size_t i = 0; i < history; ++i)
+      {
+        m_prompt.add_to_history("history entry " + std::to_string(i));
+      }
+      m_prompt.begin_session("> ", cols, rows, m_output);
+    }
+
+    /**
+     * Types given number of characters, as words separated by spaces, and
+     * moves the cursor to given position.
+     */
+    void fill(std::size_t length, position where)
+    {
+      static const char word[] = "word ";
+
+      for (std::size_t i = 0; i < length; ++i)
+      {
+        type(word + i % 5, 1);
+      }
+      if (where == position::start)
+      {
+        type("\001", 1);
+      }
+      else if (where == position::middle)
+      {
+        for (std::size_t i = 0; i < length / 2; ++i)
+        {
+          type("\002", 1);
+        }
+      }
+      m_output.clear();
+    }
+
+    /**
+     * Feeds keys to the session.
+     */
+    void type(const char* key, std::size_t length)
+    {
+      std::size_t consumed;
+      std::string line;
+
+      if (m_prompt.feed(key, length, m_output, consumed, line)
+          != peelo::prompt::feed_status::pending)
+      {
+        std::cerr << "Session ended unexpectedly." << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+    }
+
+    /**
+     * Redraws the whole input by telling the session that the terminal has
+     * been resized.
+     */
+    void resize()
+    {
+      m_prompt.resize_session(cols, rows, m_output);
+    }
+
+    /**
+     * Runs given operation in batches until enough time has been spent,
+     * and returns the median of the batches.
+     */
+    result measure(const operation& op)
+    {
+      const auto key_length = op.key ? std::strlen(op.key) : 0;
+      const auto undo_length = std::strlen(op.undo);
+      std::vector<result> batches;
+      std::chrono::steady_clock::duration total(0);
+
+      while (total < min_duration || batches.size() < 5)
+      {
+        const auto allocations = m_resource.allocations;
+
+        m_output.clear();
+
+        const auto start = std::chrono::steady_clock::now();
+
+        for (std::size_t i = 0; i < batch_size; ++i)
+        {
+          if (op.key)
+          {
+            type(op.key, key_length);
+          } else {
+            resize();
+          }
+        }
+
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+
+        total += elapsed;
+        batches.push_back({
+          std::chrono::duration<double, std::nano>(elapsed).count()
+            / batch_size,
+          static_cast<double>(m_output.length()) / batch_size,
+          static_cast<double>(m_resource.allocations - allocations)
+            / batch_size
+        });
+        for (std::size_t i = 0; i < batch_size && undo_length; ++i)
+        {
+          type(op.undo, undo_length);
+        }
+      }
+      std::nth_element(
+        std::begin(batches),
+        std::begin(batches) + batches.size() / 2,
+        std::end(batches),
+        [](const result& a, const result& b) { return a.ns < b.ns; }
+      );
+
+      return batches[batches.size() / 2];
+    }
+
+  private:
+    counting_resource m_resource;
+    peelo::prompt m_prompt;
+    std::string m_output;
+  };
+
+  result run(const operation& op, bool multi_line, std::size_t size)
+  {
+    session s(multi_line, op.history ? size : 0);
+
+    s.fill(op.history ? 0 : size, op.where);
+
+    return s.measure(op);
+  }
+
+  /**
+   * Fits the times to a power of the sizes with least squares, and returns
+   * the exponent.
+   */
+  double fit_exponent(const std::vector<double>& sizes,
+                      const std::vector<double>& times)
+  {
+    const auto n = static_cast<double>(sizes.size());
+    double sum_x = 0;
+    double sum_y = 0;
+    double sum_xx = 0;
+    double sum_xy = 0;
+
+    for (std::size_t i = 0; i < sizes.size(); ++i)
+    {
+      const auto x = std::log(sizes[i]);
+      const auto y = std::log(times[i]);
+
+      sum_x += x;
+      sum_y += y;
+      sum_xx += x * x;
+      sum_xy += x * y;
+    }
+
+    return (n * sum_xy - sum_x * sum_y) / (n * sum_xx - sum_x * sum_x);
+  }
+
+  /**
+   * Checks that time per operation does not grow faster than expected.
+   * Returns false if any of the operations grows too fast.
+   */
+  bool check_complexity(const char* filter)
+  {
+    bool success = true;
+
+    std::cout << std::left
+              << std::setw(20) << "operation"
+              << std::setw(8) << "mode"
+              << std::setw(14) << "expected"
+              << std::right
+              << std::setw(10) << "exponent"
+              << std::endl
+              << std::fixed
+              << std::setprecision(2);
+    for (const auto& op : operations)
+    {
+      if (filter && !std::strstr(op.name, filter))
+      {
+        continue;
+      }
+      for (const auto multi_line : { false, true })
+      {
+        std::vector<double> sizes;
+        std::vector<double> times;
+
+        for (const auto size : complexity_sizes)
+        {
+          sizes.push_back(static_cast<double>(size));
+          times.push_back(run(op, multi_line, size).ns);
+        }
+
+        const auto exponent = fit_exponent(sizes, times);
+        const auto ok = exponent <= max_exponent(op.expected);
+
+        std::cout << std::left
+                  << std::setw(20) << op.name
+                  << std::setw(8) << (multi_line ? "multi" : "single")
+                  << std::setw(14)
+                  << (op.expected == complexity::linear
+                    ? "linear"
+                    : "logarithmic")
+                  << std::right
+                  << std::setw(10) << exponent
+                  << (ok ? "" : "  too fast growth")
+                  << std::endl;
+        if (!ok)
+        {
+          success = false;
+        }
+      }
+    }
+
+    return success;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const char* filter = argc > 1 ? argv[1] : nullptr;
+
+  if (filter && !std::strcmp(filter, "--complexity"))
+  {
+    return check_complexity(argc > 2 ? argv[2] : nullptr)
+      ? EXIT_SUCCESS
+      : EXIT_FAILURE;
+  }
+
+  std::cout << std::left
+            << std::setw(20) << "operation"
+            << std::setw(8) << "mode"
+            << std::right
+            << std::setw(8) << "size"
+            << std::setw(12) << "ns/op"
+            << std::setw(12) << "bytes/op"
+            << std::setw(12) << "allocs/op"
+            << std::endl
+            << std::fixed;
+  for (const auto& op : operations)
+  {
+    if (filter && !std::strstr(op.name, filter))
+    {
+      continue;
+    }
+    for (const auto multi_line : { false, true })
+    {
+      for (const auto size : sizes)
+      {
+        const auto r = run(op, multi_line, size);
+
+        std::cout << std::left
+                  << std::setw(20) << op.name
+                  << std::setw(8) << (multi_line ? "multi" : "single")
+                  << std::right
+                  << std::setw(8) << size
+                  << std::setprecision(1)
+                  << std::setw(12) << r.ns
+                  << std::setw(12) << r.bytes
+                  << std::setprecision(2)
+                  << std::setw(12) << r.allocations
+                  << std::endl;
+      }
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
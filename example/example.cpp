@@ -60,15 +60,15 @@ int main(int argc, char** argv)
   );
 
   // Now this is the main loop of the typical linenoise-based application.
-  // The call to linenoise() will block as long as the user types something
+  // The call to input_into() will block as long as the user types something
   // and presses enter.
   //
-  // The typed string is returned as a malloc() allocated string by
-  // linenoise, so the user needs to free() it.
-  while (auto line = prompt.input("hello> "))
-  {
-    const auto value = line.value();
+  // The typed string is stored into the given string, which is reused for
+  // every line instead of allocating a new one.
+  std::string value;
 
+  while (prompt.input_into("hello> ", value))
+  {
     // Skip empty lines.
     if (value.empty())
     {
@@ -31,24 +31,27 @@
 #ifndef PEELO_PROMPT_HPP_GUARD
 #define PEELO_PROMPT_HPP_GUARD
 
-#include <cerrno>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
-#include <cstring>
 #include <deque>
 #include <functional>
+#include <memory>
+#include <memory_resource>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
-#include <sys/ioctl.h>
-#include <termios.h>
-#include <unistd.h>
+#include <cstdint>
 
-#if !defined(PEELO_PROMPT_MAX_LINE)
-# define PEELO_PROMPT_MAX_LINE 4096
+#if !defined(PEELO_PROMPT_HEADER_ONLY)
+# define PEELO_PROMPT_HEADER_ONLY 1
 #endif
-#if !defined(PEELO_PROMPT_DEFAULT_HISTORY_MAX_LEN)
-# define PEELO_PROMPT_DEFAULT_HISTORY_MAX_LEN 100
+#if PEELO_PROMPT_HEADER_ONLY
+# define PEELO_PROMPT_INLINE inline
+#else
+# define PEELO_PROMPT_INLINE
 #endif
 
 namespace peelo
@@ -72,48 +75,185 @@ namespace peelo
       white = 37
     };
 
+    /**
+     * State of the lexer which scans the edited text for brackets and quotes,
+     * so that it can be decided whether the input is complete without having
+     * to scan the whole text again every time enter is pressed.
+     */
+    struct lexer_state
+    {
+      /** Offset in the buffer up to which the text has been scanned. */
+      std::size_t offset;
+      /**
+       * Number of opening brackets without matching closing bracket. Negative
+       * if there are more closing brackets than opening ones.
+       */
+      int depth;
+      /** Quote character of the unterminated string, or 0 if none. */
+      char quote;
+      /** Whether the previous character was an unescaped backslash. */
+      bool escape;
+      /** Last non-whitespace character outside strings, or 0 if none. */
+      char last;
+    };
+
+    /**
+     * Shell like word in the edited text. Words are separated by whitespace,
+     * and may contain quoted strings and characters escaped with backslash.
+     */
+    struct token
+    {
+      /** Offset of the word in the buffer. */
+      std::size_t offset;
+      /** Length of the word, including quotes and escape characters. */
+      std::size_t length;
+    };
+
+    /**
+     * Read-only view to the edited text given to the callbacks, containing
+     * the words in it, so that the callbacks don't have to split the text
+     * themselves every time they are called.
+     */
+    class input_context
+    {
+    public:
+      explicit input_context(std::string_view buffer,
+                             std::size_t cursor,
+                             const std::pmr::vector<token>& tokens,
+                             const std::atomic<bool>* canceled = nullptr);
+
+      /**
+       * Returns the edited text.
+       */
+      inline std::string_view buffer() const
+      {
+        return m_buffer;
+      }
+
+      /**
+       * Returns offset of the cursor in the edited text.
+       */
+      inline std::size_t cursor() const
+      {
+        return m_cursor;
+      }
+
+      /**
+       * Returns the words in the edited text, in the order they appear in
+       * it.
+       */
+      inline const std::pmr::vector<token>& tokens() const
+      {
+        return m_tokens;
+      }
+
+      /**
+       * Returns index of the word the cursor is on or right after, or no
+       * value if the cursor is surrounded by whitespace.
+       */
+      std::optional<std::size_t> current_token() const;
+
+      /**
+       * Returns text of the given word as it appears in the edited text.
+       */
+      inline std::string_view text(const token& t) const
+      {
+        return m_buffer.substr(t.offset, t.length);
+      }
+
+      /**
+       * Returns text of the given word with quotes and escape characters
+       * removed.
+       */
+      std::string unquote(const token& t) const;
+
+      /**
+       * Returns true if the completions are no longer needed. This happens
+       * when they are computed speculatively for text which has since been
+       * edited, or for a prompt which has since been destroyed. Completion
+       * callbacks which take a while can poll this to return early.
+       */
+      inline bool is_canceled() const
+      {
+        return m_canceled && m_canceled->load(std::memory_order_relaxed);
+      }
+
+    private:
+      const std::string_view m_buffer;
+      const std::size_t m_cursor;
+      const std::pmr::vector<token>& m_tokens;
+      const std::atomic<bool>* m_canceled;
+    };
+
     using value_type = std::optional<std::string>;
-    using history_container_type = std::deque<std::string>;
-    using completion_container_type = std::vector<std::string>;
+    using history_container_type = std::pmr::deque<std::pmr::string>;
+    using completion_container_type = std::pmr::vector<std::pmr::string>;
     using completion_callback_type = std::function<void(
       const std::string&,
       completion_container_type&
     )>;
+    using vector_completion_callback_type = std::function<void(
+      const std::string&,
+      std::vector<std::string>&
+    )>;
     using hints_callback_type = std::function<value_type(
       const std::string& buffer,
       color& col,
       bool& bold
     )>;
+    using token_completion_callback_type = std::function<void(
+      const input_context&,
+      completion_container_type&
+    )>;
+    using token_hints_callback_type = std::function<value_type(
+      const input_context& context,
+      color& col,
+      bool& bold
+    )>;
+    using input_complete_callback_type = std::function<bool(
+      std::string_view buffer,
+      const lexer_state& state
+    )>;
+
+    /**
+     * Completion callback which completes the word under the cursor as path
+     * of a file. Directory listings are cached, so that completing in large
+     * directories repeatedly does not require reading them again, unless
+     * they have been modified. Copies of the callback share the same cache.
+     */
+    class path_completion
+    {
+    public:
+      explicit path_completion();
+
+      void operator()(const input_context& context,
+                      completion_container_type& completions) const;
+
+    private:
+      /**
+       * Listings of the directories, shared by the copies of the callback.
+       */
+      struct cache;
+
+      std::shared_ptr<cache> m_cache;
+    };
 
     /**
-     * The input state structure represents the state during line editing. We
-     * pass this state to functions implementing specific editing
-     * functionalities.
+     * Optional features of the terminal, detected when the prompt is used for
+     * the first time.
      */
-    struct state
+    struct terminal_capabilities
     {
-      /** Terminal stdin file descriptor. */
-      int ifd;
-      /** Terminal stdout file descriptor. */
-      int ofd;
-      /** Edited line buffer. */
-      char buf[PEELO_PROMPT_MAX_LINE];
-      /** Size of the line buffer. */
-      std::size_t buflen;
-      /** Prompt to display. */
-      std::string prompt;
-      /** Current cursor position. */
-      std::size_t pos;
-      /** Previous refresh cursor position. */
-      std::size_t oldpos;
-      /** Current edited line length. */
-      std::size_t len;
-      /** Number of columns in terminal. */
-      std::size_t cols;
-      /** Maximum number of rows used so far (multiline mode). */
-      std::size_t maxrows;
-      /** The history index we are currently editing. */
-      int history_index;
+      /** Whether bracketed paste mode (DEC private mode 2004) is supported. */
+      bool bracketed_paste;
+      /** Whether synchronized output (DEC private mode 2026) is supported. */
+      bool synchronized_output;
+      /** Whether 24-bit colors are supported. */
+      bool truecolor;
+      /** Whether kitty keyboard protocol is supported. */
+      bool kitty_keyboard;
+      /** Name and version of the terminal, as reported by XTVERSION. */
+      std::string version;
     };
 
     enum class key
@@ -126,6 +266,7 @@ namespace peelo
       ctrl_f = 6,
       ctrl_h = 8,
       tab = 9,
+      ctrl_j = 10,
       ctrl_k = 11,
       ctrl_l = 12,
       enter = 13,
@@ -138,15 +279,29 @@ namespace peelo
       backspace = 127
     };
 
-    explicit prompt()
-      : m_multi_line(false)
-      , m_raw_mode(false)
-      , m_history_max_size(PEELO_PROMPT_DEFAULT_HISTORY_MAX_LEN) {}
-
-    ~prompt()
+    /**
+     * Tells what happened to the session when input was fed to it.
+     */
+    enum class feed_status
     {
-      disable_raw_mode(STDIN_FILENO);
-    }
+      /** The line is still being edited. */
+      pending,
+      /** The user entered a line. */
+      line,
+      /** The user signaled end of input. */
+      end_of_input
+    };
+
+    /**
+     * Constructs the prompt. Memory used for the history, completions, the
+     * edited line and its output is allocated from the given memory
+     * resource, which must outlive the prompt. As the resource is used by
+     * the thread editing the lines only, it does not need to be thread safe.
+     */
+    explicit prompt(std::pmr::memory_resource* resource =
+                      std::pmr::get_default_resource());
+
+    ~prompt();
 
     prompt(const prompt&) = delete;
     prompt(prompt&&) = delete;
@@ -160,1173 +315,487 @@ namespace peelo
      * line editing function or uses dummy fgets() so that you will be able to
      * type something even in the most desperate of the conditions.
      */
-    value_type input(const std::string& prompt)
-    {
-      if (!::isatty(STDIN_FILENO))
-      {
-        // Not a TTY: Read from file / pipe. In this mode we don't want any
-        // limit to the line size, so we call a function to handle that.
-        return input_no_tty();
-      }
-      else if (is_unsupported_term())
-      {
-        char buf[PEELO_PROMPT_MAX_LINE];
-        std::size_t length;
-
-        std::printf("%s", prompt.c_str());
-        std::fflush(stdout);
-        if (!std::fgets(buf, PEELO_PROMPT_MAX_LINE, stdin))
-        {
-          return value_type();
-        }
-        length = std::strlen(buf);
-        while (length && (buf[length-1] == '\n' || buf[length-1] == '\r'))
-        {
-          --length;
-          buf[length] = '\0';
-        }
-
-        return std::make_optional<std::string>(buf, length);
-      }
-
-      return input_raw(prompt);
-    }
+    value_type input(const std::string& prompt);
 
     /**
-     * Clears the screen. Used to handle ^L.
+     * Same as input(), except that the line is stored into given string,
+     * reusing its capacity instead of allocating a new string for each line.
+     * Returns false at end of input.
      */
-    void clear_screen()
-    {
-      if (::write(STDOUT_FILENO, "\033[H\033[2J", 7) < 0)
-        ;
-    }
+    bool input_into(const std::string& prompt, std::string& output);
 
     /**
-     * Returns a boolean flag which tells whether multi line mode is currently
-     * used or not.
+     * Same as input(), except that the line is returned as a view which
+     * remains valid until this function is called again. When reading ahead
+     * is enabled, the view points directly to the input read ahead, so the
+     * line is not copied at all.
      */
-    inline bool is_multi_line() const
-    {
-      return m_multi_line;
-    }
+    std::optional<std::string_view> input_view(const std::string& prompt);
 
     /**
-     * Sets the flag whether multi line mode is being used or not.
+     * Clears the screen. Used to handle ^L.
      */
-    inline void set_multi_line(bool flag)
-    {
-      m_multi_line = true;
-    }
+    void clear_screen();
 
     /**
-     * Adds new entry in the history.
+     * Begins editing a new line without reading from or writing to the
+     * terminal. Input is then given to the session with feed() and output
+     * meant for the terminal is appended to a string instead. This allows
+     * single thread to drive multiple prompts from an event loop. The
+     * terminal is expected to be in raw mode already.
      */
-    bool add_to_history(const std::string& line)
-    {
-      if (m_history_max_size == 0)
-      {
-        return false;
-      }
-
-      // Don't add duplicated lines.
-      if (!m_history_container.empty() &&
-          !m_history_container.back().compare(line))
-      {
-        return false;
-      }
-
-      if (m_history_container.size() == m_history_max_size)
-      {
-        m_history_container.pop_front();
-      }
-
-      m_history_container.push_back(line);
-
-      return true;
-    }
+    void begin_session(const std::string& prompt,
+                       std::size_t cols,
+                       std::size_t rows,
+                       std::string& output);
 
     /**
-     * Returns the maximum size of the history.
+     * Feeds input received from the terminal to the session started with
+     * begin_session(). Output is appended to the given string and number of
+     * bytes processed is stored to 'consumed'. Once the user is done with
+     * the line, the session ends and the line is stored to 'line'; rest of
+     * the input should then be given to the next session.
      */
-    inline std::size_t get_history_max_size() const
-    {
-      return m_history_max_size;
-    }
+    feed_status feed(const char* data,
+                     std::size_t length,
+                     std::string& output,
+                     std::size_t& consumed,
+                     std::string& line);
 
     /**
-     * Sets the maximum size of the history.
+     * Tells the session started with begin_session() that the terminal has
+     * been resized. The line is redrawn into given string.
      */
-    void set_history_max_size(std::size_t size)
-    {
-      if (size == 0)
-      {
-        m_history_container.clear();
-      } else {
-        while (m_history_container.size() > size)
-        {
-          m_history_container.pop_front();
-        }
-      }
-      m_history_max_size = size;
-    }
+    void resize_session(std::size_t cols,
+                        std::size_t rows,
+                        std::string& output);
 
     /**
-     * Registers a callback function to be called during tab-completion.
+     * Returns true if a session started with begin_session() is still
+     * editing a line.
      */
-    inline void set_completion_callback(
-      const std::optional<completion_callback_type>& callback
-    )
-    {
-      m_completion_callback = callback;
-    }
+    bool is_session_active() const;
 
     /**
-     * Register a callback to be called to display hints to the user at the
-     * right of the prompt.
+     * Returns a boolean flag which tells whether multi line mode is currently
+     * used or not.
      */
-    inline void set_hints_callback(
-      const std::optional<hints_callback_type>& callback
-    )
-    {
-      m_hints_callback = callback;
-    }
+    bool is_multi_line() const;
 
     /**
-     * Returns true if the terminal name is in the list of terminals we know
-     * are not able to understand basic escape sequences.
+     * Sets the flag whether multi line mode is being used or not.
      */
-    static bool is_unsupported_term()
-    {
-      static const char* unsupported_term[] =
-      {
-        "dumb",
-        "cons25",
-        "emacs",
-        NULL
-      };
-      auto term = std::getenv("TERM");
-
-      if (!term)
-      {
-        return false;
-      }
-      for (int i = 0; unsupported_term[i]; ++i)
-      {
-        if (!::strcasecmp(term, unsupported_term[i]))
-        {
-          return true;
-        }
-      }
+    void set_multi_line(bool flag);
 
-      return false;
-    }
-
-  private:
     /**
-     * This function is called when input() is called with the standard input
-     * file descriptor not attached to a TTY. So for example when the program
-     * using this library is called in pipe or with a file redirected to it's
-     * standard input. In this case, we want to be able to return the line
-     * regardless of it's length.
+     * Adds new entry in the history.
      */
-    static value_type input_no_tty()
-    {
-      std::string line;
-
-      for (;;)
-      {
-        const auto c = std::fgetc(stdin);
-
-        if (c == EOF || c == '\n')
-        {
-          if (c == EOF && line.empty())
-          {
-            return value_type();
-          }
-
-          return value_type(line);
-        }
-        line.append(1, static_cast<char>(c));
-      }
-    }
+    bool add_to_history(const std::string& line);
 
     /**
-     * This function calls the line editing function edit() using the STDIN
-     * file descriptor set in raw mode.
+     * Returns the maximum size of the history.
      */
-    value_type input_raw(const std::string& prompt)
-    {
-      value_type result;
-
-      if (!enable_raw_mode(STDIN_FILENO))
-      {
-        return value_type();
-      }
-      result = edit(STDIN_FILENO, STDOUT_FILENO, prompt);
-      disable_raw_mode(STDIN_FILENO);
-      std::printf("\n");
-
-      return result;
-    }
+    std::size_t get_history_max_size() const;
 
     /**
-     * This function is the core of the line editing capability of this
-     * library. It expects 'fd' to be already in "raw mode" so that every key
-     * pressed will be returned ASAP to read().
-     *
-     * The resulting string is returned by the function when the user types
-     * enter, or when ^D is typed.
+     * Sets the maximum size of the history.
      */
-    value_type edit(int stdin_fd, int stdout_fd, const std::string& prompt)
-    {
-      struct state state;
-
-      // Populate the input state that we pass to functions implementing
-      // specific editing functionalities.
-      state.ifd = stdin_fd;
-      state.ofd = stdout_fd;
-      state.buflen = PEELO_PROMPT_MAX_LINE;
-      state.prompt = prompt;
-      state.oldpos = 0;
-      state.pos = 0;
-      state.len = 0;
-      state.cols = get_columns(stdin_fd, stdout_fd);
-      state.maxrows = 0;
-      state.history_index = 0;
-
-      // Buffer starts empty.
-      state.buf[0] = '\0';
-      // Make sure there is always space for the nulterm.
-      --state.buflen;
-
-      // Latest history entry is always our current buffer, that initially is
-      // just an empty string.
-      m_history_container.push_back(std::string());
-
-      if (::write(state.ofd, prompt.c_str(), prompt.length()) == -1)
-      {
-        return value_type();
-      }
-
-      for (;;)
-      {
-        char c;
-
-        if (::read(state.ifd, &c, 1) <= 0)
-        {
-          return std::make_optional<std::string>(state.buf, state.len);
-        }
-
-        // Only autocomplete when the callback is set. It returns < 0 when
-        // there was an error reading from the fd. Otherwise it will return the
-        // character that should be handled next.
-        if (c == static_cast<int>(key::tab) && m_completion_callback)
-        {
-          // Return on errors.
-          if ((c = complete_line(state)) < 0)
-          {
-            return std::make_optional<std::string>(state.buf, state.len);
-          }
-          // Read next character when 0.
-          else if (c == 0)
-          {
-            continue;
-          }
-        }
-
-        switch (c)
-        {
-          case static_cast<int>(key::enter):
-            if (!m_history_container.empty())
-            {
-              m_history_container.pop_back();
-            }
-            if (m_multi_line)
-            {
-              move_end(state);
-            }
-            if (m_hints_callback)
-            {
-              // Force a refresh without hints to leave the previous line as
-              // the user typed it after a newline.
-              const auto callback = m_hints_callback;
-
-              m_hints_callback.reset();
-              refresh(state);
-              m_hints_callback = callback;
-            }
-            return std::make_optional<std::string>(state.buf, state.len);
-
-          case static_cast<int>(key::ctrl_c):
-            errno = EAGAIN;
-            return value_type();
-
-          case static_cast<int>(key::backspace):
-          case static_cast<int>(key::ctrl_h):
-            delete_previous_char(state);
-            break;
-
-          case static_cast<int>(key::ctrl_d):
-            // Remove character at the right of the cursor, or if the line is
-            // empty, act as end-of-file.
-            if (state.len > 0)
-            {
-              delete_next_char(state);
-            } else {
-              if (!m_history_container.empty())
-              {
-                m_history_container.pop_back();
-              }
-
-              return value_type();
-            }
-            break;
-
-          case static_cast<int>(key::ctrl_t):
-            transpose_characters(state);
-            break;
-
-          case static_cast<int>(key::ctrl_b):
-            move_left(state);
-            break;
-
-          case static_cast<int>(key::ctrl_f):
-            move_right(state);
-            break;
-
-          case static_cast<int>(key::ctrl_p):
-            edit_history_next(state, false);
-            break;
-
-          case static_cast<int>(key::ctrl_n):
-            edit_history_next(state, true);
-            break;
-
-          case static_cast<int>(key::esc):
-            handle_esc(state);
-            break;
-
-          case static_cast<int>(key::ctrl_u):
-            kill_line(state);
-            break;
-
-          case static_cast<int>(key::ctrl_k):
-            kill_end_of_line(state);
-            break;
-
-          case static_cast<int>(key::ctrl_a):
-            move_home(state);
-            break;
-
-          case static_cast<int>(key::ctrl_e):
-            move_end(state);
-            break;
-
-          case static_cast<int>(key::ctrl_l):
-            clear_screen();
-            refresh(state);
-            break;
-
-          case static_cast<int>(key::ctrl_w):
-            delete_previous_word(state);
-            break;
-
-          default:
-            if (!insert(state, c))
-            {
-              return value_type();
-            }
-            break;
-        }
-      }
-    }
+    void set_history_max_size(std::size_t size);
 
     /**
-     * Raw mode: 1960 magic shit.
+     * Registers a callback function to be called during tab-completion.
      */
-    bool enable_raw_mode(int fd)
-    {
-      ::termios raw;
-
-      if (!::isatty(STDIN_FILENO))
-      {
-        return false;
-      }
-
-      if (::tcgetattr(fd, &m_original_termios) == -1)
-      {
-        return false;
-      }
-
-      // Modify the original one.
-      raw = m_original_termios;
-
-      // Input modes: No break, no CR to NL, no parity check, no strip char, no
-      // start/stop output control.
-      raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
-
-      // Output modes: Disable post processing.
-      raw.c_oflag &= ~(OPOST);
-
-      // Control modes: Set 8 bit chars.
-      raw.c_cflag |= (CS8);
-
-      // Local modes: Echoing off, canonical off, no extended functions, no
-      // signal chars (^Z, ^C).
-      raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
-
-      // Control chars: Set return condition: min number of bytes and timer. We
-      // want to read to return every single byte, without timeout.
-      raw.c_cc[VMIN] = 1;
-      raw.c_cc[VTIME] = 0;
-
-      // Put terminal in raw mode after flushing.
-      if (::tcsetattr(fd, TCSAFLUSH, &raw) < 0)
-      {
-        return false;
-      }
-
-      m_raw_mode = true;
-
-      return true;
-    }
-
-    void disable_raw_mode(int fd)
-    {
-      if (m_raw_mode)
-      {
-        ::tcsetattr(fd, TCSAFLUSH, &m_original_termios);
-        m_raw_mode = false;
-      }
-    }
+    void set_completion_callback(
+      const std::optional<completion_callback_type>& callback
+    );
 
     /**
-     * Calls the two low level functions refresh_single_line() or
-     * refresh_multi_line() according to the selected mode.
+     * Registers a completion callback which inserts the completions into a
+     * std::vector of std::string, as completion callbacks did before the
+     * completions were allocated from the memory resource of the prompt.
+     * The completions are copied into the container of the prompt.
      */
-    void refresh(struct state& state)
-    {
-      if (m_multi_line)
-      {
-        refresh_multi_line(state);
-      } else {
-        refresh_single_line(state);
-      }
-    }
+    void set_completion_callback(
+      const vector_completion_callback_type& callback
+    );
 
     /**
-     * Single line low level line refresh.
-     *
-     * Rewrite the currently edited line accordingly to the buffer content,
-     * cursor position and number of columns of the terminal.
+     * Registers a callback function to be called during tab-completion, which
+     * is given the words in the edited text and the position of the cursor
+     * instead of just the text.
      */
-    void refresh_single_line(struct state& state)
-    {
-      char seq[64];
-      auto plen = state.prompt.length();
-      const auto fd = state.ofd;
-      auto buf = state.buf;
-      auto len = state.len;
-      auto pos = state.pos;
-      std::string buffer;
-
-      while ((plen + pos) >= state.cols)
-      {
-        ++buf;
-        --len;
-        --pos;
-      }
-      while (plen + len > state.cols)
-      {
-        --len;
-      }
-
-      // Cursor to left edge.
-      buffer.append(1, '\r');
-
-      // Write the prompt and the current buffer content.
-      buffer.append(state.prompt);
-      buffer.append(buf, len);
-
-      // Show hits if any.
-      show_hints(buffer, state);
-
-      // Erase to right.
-      buffer.append("\033[0K");
-
-      // Move cursor to original position. */
-      std::snprintf(seq, 64, "\r\x1b[%dC", static_cast<int>(pos + plen));
-      buffer.append(seq, std::strlen(seq));
-
-      if (::write(fd, buffer.c_str(), buffer.length()) < 0)
-        ;
-    }
+    void set_token_completion_callback(
+      const std::optional<token_completion_callback_type>& callback
+    );
 
     /**
-     * Multi line low level line refresh.
-     *
-     * Rewrite the currently edited line accordingly to the buffer content,
-     * cursor position and number of columns of the terminal.
+     * Register a callback to be called to display hints to the user at the
+     * right of the prompt.
      */
-    void refresh_multi_line(struct state& state)
-    {
-      char seq[64];
-      auto plen = state.prompt.length();
-      // Rows used by current buf.
-      int rows = (plen + state.len + state.cols - 1) / state.cols;
-      // Cursor relative row.
-      int rpos = (plen + state.oldpos + state.cols) / state.cols;
-      // rpos after refresh.
-      int rpos2;
-      // Column position, zero based.
-      int col;
-      const int old_rows = state.maxrows;
-      const int fd = state.ofd;
-      std::string buffer;
-
-      // Update maxrows if needed.
-      if (rows > static_cast<int>(state.maxrows))
-      {
-        state.maxrows = rows;
-      }
-
-      // First step: Clear all the lines used before. To do so start by going
-      // to the last row.
-      if (old_rows - rpos > 0)
-      {
-        std::snprintf(seq, 64, "\x1b[%dB", old_rows - rpos);
-        buffer.append(seq, std::strlen(seq));
-      }
-
-      // Now for every row clear it, go up.
-      for (int j = 0; j < old_rows - 1; ++j)
-      {
-        buffer.append("\r\x1b[0K\x1b[1A");
-      }
-
-      // Clean the top line.
-      buffer.append("\r\x1b[0K");
-
-      // Write the prompt and the current buffer content.
-      buffer.append(state.prompt);
-      buffer.append(state.buf, state.len);
-
-      // Show hits if any.
-      show_hints(buffer, state);
-
-      // If we are at the very end of the screen with our prompt, we need to
-      // emit a newline and move the prompt to the first column.
-      if (state.pos &&
-          state.pos == state.len &&
-          (state.pos + plen) % state.cols == 0)
-      {
-        buffer.append("\n\r");
-        if (++rows > static_cast<int>(state.maxrows))
-        {
-          state.maxrows = rows;
-        }
-      }
-
-      // Move cursor to right position.
-      rpos2 = (plen + state.pos + state.cols) / state.cols;
-
-      // Go up till we reach the expected positon.
-      if (rows - rpos2 > 0)
-      {
-        std::snprintf(seq, 64, "\x1b[%dA", rows - rpos2);
-        buffer.append(seq, std::strlen(seq));
-      }
-
-      // Set column.
-      col = (plen + static_cast<int>(state.pos)) % static_cast<int>(state.cols);
-      if (col)
-      {
-        std::snprintf(seq, 64, "\r\x1b[%dC", col);
-      } else {
-        std::snprintf(seq, 64, "\r");
-      }
-      buffer.append(seq, std::strlen(seq));
-
-      state.oldpos = state.pos;
-
-      if (::write(fd, buffer.c_str(), buffer.length()) < 0)
-        ;
-    }
+    void set_hints_callback(
+      const std::optional<hints_callback_type>& callback
+    );
 
     /**
-     * Use the ESC [6n escape sequence to query the horizontal cursor position
-     * and return it. On error, -1 is returned, on success the position of the
-     * cursor.
+     * Register a callback to be called to display hints to the user at the
+     * right of the prompt, which is given the words in the edited text and
+     * the position of the cursor instead of just the text.
      */
-    static int get_cursor_position(int ifd, int ofd)
-    {
-      char buffer[32];
-      int cols;
-      int rows;
-      std::size_t i = 0;
-
-      // Report cursor location.
-      if (::write(ofd, "\033[6n", 4) != 4)
-      {
-        return -1;
-      }
-
-      // Read the response: ESC [ rows ; cols R
-      while (i < sizeof(buffer))
-      {
-        if (::read(ifd, buffer + i, 1) != 1 || buffer[i] == 'R')
-        {
-          break;
-        }
-        ++i;
-      }
-      buffer[i] = '\0';
-
-      // Parse it.
-      if (buffer[0] != static_cast<int>(key::esc) ||
-          buffer[1] != '[' ||
-          std::sscanf(buffer + 2, "%d;%d", &rows, &cols) != 2)
-      {
-        return -1;
-      }
-
-      return cols;
-    }
+    void set_token_hints_callback(
+      const std::optional<token_hints_callback_type>& callback
+    );
 
     /**
-     * Try to get the number of columns in the current terminal, or assume 80
-     * if it fails.
+     * Returns a boolean flag which tells whether input is read ahead on a
+     * background thread when the standard input is not a TTY.
      */
-    static int get_columns(int ifd, int ofd)
-    {
-      ::winsize ws;
-
-      if (::ioctl(1, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
-      {
-        // ioctl() failed. Try to query the terminal itself.
-        int start;
-        int cols;
-
-        // Get the initial position so we can restore it later.
-        if ((start = get_cursor_position(ifd, ofd)) == -1)
-        {
-          goto FAILED;
-        }
-
-        // Go right margin and get position.
-        if (::write(ofd, "\033[999C", 6) != 6)
-        {
-          goto FAILED;
-        }
-
-        if ((cols = get_cursor_position(ifd, ofd)) == -1)
-        {
-          goto FAILED;
-        }
-
-        // Restore position.
-        if (cols > start)
-        {
-          char sequence[32];
-
-          std::snprintf(sequence, 32, "\033[%dD", cols - start);
-          if (::write(ofd, sequence, std::strlen(sequence)) < 0)
-            ;
-        }
-
-        return cols;
-      } else {
-        return ws.ws_col;
-      }
-
-  FAILED:
-      return 80;
-    }
+    bool is_read_ahead() const;
 
     /**
-     * Beep, used for completion when there is nothing to complete or when all
-     * the choices were already shown.
+     * Sets the flag whether input is read ahead on a background thread when
+     * the standard input is not a TTY. Since the standard input is then read
+     * directly, it should not be read with other means at the same time.
      */
-    static void beep()
-    {
-      std::fprintf(stderr, "\x7");
-      std::fflush(stderr);
-    }
+    void set_read_ahead(bool flag);
 
     /**
-     * Insert the character 'c' at cursor's current position. On error writing
-     * to the terminal, false is returned, otherwise true.
+     * Returns a boolean flag which tells whether completions are shown in a
+     * menu below the input, instead of cycling through them one at a time.
      */
-    bool insert(struct state& state, char c)
-    {
-      if (state.len < state.buflen)
-      {
-        if (state.len == state.pos)
-        {
-          state.buf[state.pos] = c;
-          ++state.pos;
-          ++state.len;
-          state.buf[state.len] = '\0';
-          if (!m_multi_line
-              && state.prompt.length() + state.len < state.cols
-              && !m_hints_callback)
-          {
-            // Avoid a full update of the line in the trivial case.
-            if (::write(state.ofd, &c, 1) == -1)
-            {
-              return false;
-            }
-          } else {
-            refresh(state);
-          }
-        } else {
-          std::memmove(
-            static_cast<void*>(state.buf + state.pos + 1),
-            static_cast<const void*>(state.buf + state.pos),
-            state.len - state.pos
-          );
-          state.buf[state.pos] = c;
-          ++state.len;
-          ++state.pos;
-          state.buf[state.len] = '\0';
-          refresh(state);
-        }
-      }
-
-      return true;
-    }
+    bool is_completion_menu() const;
 
     /**
-     * Move cursor on the left.
+     * Sets the flag whether completions are shown in a menu below the input
+     * or not.
      */
-    void move_left(struct state& state)
-    {
-      if (state.pos > 0)
-      {
-        --state.pos;
-        refresh(state);
-      }
-    }
+    void set_completion_menu(bool flag);
 
     /**
-     * Move cursor on the right.
+     * Enables ranking of completions. Completions which do not contain the
+     * characters of the word under the cursor in the same order are
+     * discarded, and at most 'limit' best matching ones are shown, ordered
+     * by how well they match. Large number of completions is ranked in
+     * parallel on a thread pool shared by all prompts. Passing no limit
+     * disables ranking.
      */
-    void move_right(struct state& state)
-    {
-      if (state.pos != state.len)
-      {
-        ++state.pos;
-        refresh(state);
-      }
-    }
+    void set_completion_ranking(const std::optional<std::size_t>& limit);
 
     /**
-     * Move cursor to the start of the line.
+     * Enables speculative completion. When the user stops typing for given
+     * amount of time, completions for the edited text are computed on a
+     * background thread, so that they are ready when tab is pressed. At most
+     * 'limit' computations are run at the same time, and results computed
+     * for text which has been edited since are discarded. Since the
+     * completion callback may then be called from multiple threads at the
+     * same time, it must be thread safe. Passing no delay disables
+     * speculative completion.
+     *
+     * Computations for text which has been edited since are canceled, but
+     * count against the limit until the callback returns. Editing does not
+     * wait for them, but destroying the prompt does, so the callback may
+     * refer to anything which outlives the prompt. The callback should poll
+     * input_context::is_canceled() to return early.
+     *
+     * Sessions driven with feed() cannot wait for the user to stop typing,
+     * so computation begins right after each feed() which leaves the line
+     * being edited, regardless of the delay.
      */
-    void move_home(struct state& state)
-    {
-      if (state.pos != 0)
-      {
-        state.pos = 0;
-        refresh(state);
-      }
-    }
+    void set_speculative_completion(
+      const std::optional<std::chrono::milliseconds>& delay,
+      std::size_t limit = 1
+    );
 
     /**
-     * Move cursor to the end of the line.
+     * Registers a callback to be called when enter is pressed in multi line
+     * mode, to decide whether the input is complete. If the callback returns
+     * false, a newline is inserted instead of returning the input.
      */
-    void move_end(struct state& state)
-    {
-      if (state.pos != state.len)
-      {
-        state.pos = state.len;
-        refresh(state);
-      }
-    }
+    void set_input_complete_callback(
+      const std::optional<input_complete_callback_type>& callback
+    );
 
     /**
-     * Substitute the currently edited line with the next or previous history
-     * entry as specified by 'direction'.
+     * Begins recording input of the user, with the time between each key
+     * and changes of the terminal size, into given file. The recording can
+     * be replayed with the recording class. Returns false if the file cannot
+     * be opened.
      */
-    void edit_history_next(struct state& state, bool direction)
-    {
-      const auto size = m_history_container.size();
-
-      if (size < 2)
-      {
-        return;
-      }
-      // Update the current history entry before overwriting it with the next
-      // one.
-      m_history_container.back() = std::string(state.buf, state.len);
-      // Show the next entry.
-      state.history_index += direction ? -1 : 1;
-      if (state.history_index < 0)
-      {
-        state.history_index = 0;
-        return;
-      }
-      else if (state.history_index >= static_cast<int>(size))
-      {
-        state.history_index = size - 1;
-        return;
-      }
-
-      const auto& entry = m_history_container[size - 1 - state.history_index];
-
-      std::strncpy(state.buf, entry.c_str(), state.buflen);
-      state.buf[state.buflen - 1] = '\0';
-      state.len = state.pos = std::strlen(state.buf);
-      refresh(state);
-    }
+    bool start_recording(const std::string& path);
 
     /**
-     * Delete the character at the right of the cursor without altering the
-     * cursor position. Basically this is what happens with the "Delete"
-     * keyboard key.
+     * Stops recording started with start_recording().
      */
-    void delete_next_char(struct state& state)
-    {
-      if (state.len > 0 && state.pos < state.len)
-      {
-        std::memmove(
-          static_cast<void*>(state.buf + state.pos),
-          static_cast<const void*>(state.buf + state.pos + 1),
-          state.len - state.pos - 1
-        );
-        --state.len;
-        state.buf[state.len] = '\0';
-        refresh(state);
-      }
-    }
+    void stop_recording();
 
     /**
-     * Backspace implementation.
+     * Enables tracing of the internals of the editor. Time spent processing
+     * each key, in the callbacks, building frames of output and writing them
+     * to the terminal is recorded into a ring buffer holding given number of
+     * the latest events. If a file name is given, the events are written to
+     * it when the prompt is destroyed. Capacity of zero disables tracing.
+     * This should not be called while a line is being edited.
      */
-    void delete_previous_char(struct state& state)
-    {
-      if (state.pos > 0 && state.len > 0)
-      {
-        std::memmove(
-          static_cast<void*>(state.buf + state.pos - 1),
-          static_cast<const void*>(state.buf + state.pos),
-          state.len - state.pos
-        );
-        --state.pos;
-        --state.len;
-        state.buf[state.len] = '\0';
-        refresh(state);
-      }
-    }
+    void set_tracing(std::size_t capacity,
+                     const std::string& path = std::string());
 
     /**
-     * Delete the previous word, maintaining the cursor at the start of the
-     * current word.
+     * Writes the events recorded since tracing was enabled into a file, in
+     * Chrome trace event format which can be opened in Perfetto. Returns
+     * false if tracing is not enabled or the file cannot be written.
      */
-    void delete_previous_word(struct state& state)
-    {
-      const auto old_pos = state.pos;
-      std::size_t diff;
-
-      while (state.pos > 0 && state.buf[state.pos - 1] == ' ')
-      {
-        --state.pos;
-      }
-      while (state.pos > 0 && state.buf[state.pos - 1] != ' ')
-      {
-        --state.pos;
-      }
-      diff = old_pos - state.pos;
-      std::memmove(
-        static_cast<void*>(state.buf + state.pos),
-        static_cast<const void*>(state.buf + old_pos),
-        state.len - old_pos + 1
-      );
-      state.len -= diff;
-      refresh(state);
-    }
+    bool dump_trace(const std::string& path) const;
 
     /**
-     * Swaps current character with previous one.
+     * Returns capabilities of the terminal. These are detected when input is
+     * read from the terminal for the first time, until then all of them are
+     * reported as unsupported.
      */
-    void transpose_characters(struct state& state)
-    {
-      if (state.pos > 0 && state.pos < state.len)
-      {
-        const auto aux = state.buf[state.pos - 1];
-
-        state.buf[state.pos - 1] = state.buf[state.pos];
-        state.buf[state.pos] = aux;
-        if (state.pos != state.len - 1)
-        {
-          ++state.pos;
-        }
-        refresh(state);
-      }
-    }
+    const terminal_capabilities& get_terminal_capabilities() const;
 
     /**
-     * Deletes the whole line.
+     * Returns true if the terminal name is in the list of terminals we know
+     * are not able to understand basic escape sequences. The terminal name is
+     * looked up only once, and the result is cached for the rest of the
+     * session.
      */
-    void kill_line(struct state& state)
-    {
-      state.buf[0] = '\0';
-      state.pos = 0;
-      state.len = 0;
-      refresh(state);
-    }
+    static bool is_unsupported_term();
 
+#if defined(__linux__)
     /**
-     * Deletes characters from current position to end of line.
+     * Base class for event loops driving line editing sessions on multiple
+     * terminals from a single thread. Lines on each terminal are edited with
+     * a prompt instance of their own, and the lines entered are given to a
+     * callback.
      */
-    void kill_end_of_line(struct state& state)
+    class driver
     {
-      state.buf[state.pos] = '\0';
-      state.len = state.pos;
-      refresh(state);
-    }
+    public:
+      /**
+       * Callback invoked with file descriptor of the terminal and the line
+       * entered on it, or no value at end of input. Returning false stops
+       * prompting that terminal for more lines.
+       */
+      using line_callback_type = std::function<bool(int, const value_type&)>;
 
-    /**
-     * Read the next two bytes representing the escape sequence. Use two calls
-     * to handle slow terminals returning the two characters at different
-     * times.
-     */
-    void handle_esc(struct state& state)
-    {
-      char seq[3];
+      driver(const driver&) = delete;
+      driver(driver&&) = delete;
+      void operator=(const driver&) = delete;
+      void operator=(driver&&) = delete;
 
-      if (::read(state.ifd, seq, 1) == -1
-          || ::read(state.ifd, seq + 1, 1) == -1)
-      {
-        return;
-      }
+    protected:
+      /**
+       * Bookkeeping of the terminals shared by the drivers, which the
+       * implementation of each driver builds on.
+       */
+      struct impl;
 
-      // ESC [ sequences.
-      if (seq[0] == '[')
-      {
-        if (std::isdigit(seq[1]))
-        {
-          // Extended escape, read additional byte.
-          if (::read(state.ifd, seq + 2, 1) == -1)
-          {
-            return;
-          }
-          else if (seq[2] == '~')
-          {
-            switch (seq[1])
-            {
-              case '3': // Delete key
-                delete_next_char(state);
-                break;
-
-              case '1': // Home (PuTTY)
-                move_home(state);
-                break;
-
-              case '4': // End (PuTTY)
-                move_end(state);
-                break;
-            }
-          }
-        } else {
-          switch (seq[1])
-          {
-            case 'A': // Up
-              edit_history_next(state, false);
-              break;
-
-            case 'B': // Down
-              edit_history_next(state, true);
-              break;
-
-            case 'C': // Right
-              move_right(state);
-              break;
-
-            case 'D': // Left
-              move_left(state);
-              break;
-
-            case 'H': // Home
-              move_home(state);
-              break;
-
-            case 'F': // End
-              move_end(state);
-              break;
-          }
-        }
-      }
-      // ESC O sequences.
-      else if (seq[0] == 'O')
-      {
-        switch (seq[1])
-        {
-          case 'H': // Home
-            move_home(state);
-            break;
-
-          case 'F': // End
-            move_end(state);
-            break;
-        }
-      }
-    }
+      driver() = default;
+
+      ~driver() = default;
+    };
 
     /**
-     * This is an helper function for edit() and is called when the user
-     * types the <tab> key in order to complete the string currently in the
-     * input.
-     *
-     * The state of the editing is encapsulated into the pointed input state
-     * structure as described in the structure definition.
+     * Driver which waits for the terminals with epoll, and reads input and
+     * writes output with one read() and write() call per event.
      */
-    int complete_line(struct state& state)
+    class epoll_driver : public driver
     {
-      completion_container_type completions;
-      int c = -1;
+    public:
+      /**
+       * Constructs the driver. Bookkeeping of the terminals is allocated
+       * from given memory resource.
+       */
+      explicit epoll_driver(
+        const line_callback_type& callback,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+      );
 
-      if (m_completion_callback)
-      {
-        (*m_completion_callback)(
-          std::string(state.buf, state.len),
-          completions
-        );
-      }
+      ~epoll_driver();
+
+      /**
+       * Returns true if the driver was initialized successfully.
+       */
+      bool is_open() const;
+
+      /**
+       * Returns number of terminals being driven.
+       */
+      std::size_t size() const;
+
+      /**
+       * Begins prompting for lines on terminal with given file descriptor and
+       * size, using given prompt instance for editing them. The terminal is
+       * expected to be in raw mode, and it's switched to non-blocking mode.
+       * Returns false if an error occurs.
+       */
+      bool add(int fd,
+               prompt& editor,
+               const std::string& prompt,
+               std::size_t cols,
+               std::size_t rows);
+
+      /**
+       * Stops driving the terminal. Output not yet written to it is
+       * discarded. The file descriptor is not closed.
+       */
+      void remove(int fd);
+
+      /**
+       * Tells that the terminal has been resized.
+       */
+      void resize(int fd, std::size_t cols, std::size_t rows);
+
+      /**
+       * Waits for the terminals for given number of milliseconds, or
+       * indefinitely if the timeout is negative, and processes their input.
+       * Returns number of events processed, or -1 on error.
+       */
+      int run_once(int timeout);
+
+    private:
+      struct impl;
+
+      std::unique_ptr<impl> m_impl;
+    };
 
-      if (completions.empty())
-      {
-        beep();
-      } else {
-        bool stop = false;
-        completion_container_type::size_type i = 0;
-
-        while (!stop)
-        {
-          // Show completion or original buffer.
-          if (i < completions.size())
-          {
-            const auto& completion = completions[i];
-            struct state saved = state;
-
-            state.len = state.pos = completion.length();
-            std::strncpy(state.buf, completion.c_str(), state.buflen);
-            refresh(state);
-            state.len = saved.len;
-            state.pos = saved.pos;
-            std::strncpy(state.buf, saved.buf, state.buflen);
-          } else {
-            refresh(state);
-          }
-
-          if (::read(state.ifd, &c, 1) <= 0)
-          {
-            return -1;
-          }
-
-          switch (c)
-          {
-            case static_cast<int>(key::tab):
-              i = (i + 1) % (completions.size() + 1);
-              if (i == completions.size())
-              {
-                beep();
-              }
-              break;
-
-            case static_cast<int>(key::esc):
-              // Re-show original buffer.
-              if (i < completions.size())
-              {
-                refresh(state);
-              }
-              stop = true;
-              break;
-
-            default:
-              // Update buffer and return.
-              if (i < completions.size())
-              {
-                const auto written = std::snprintf(
-                  state.buf,
-                  state.buflen,
-                  "%s",
-                  completions[i].c_str()
-                );
-
-                state.len = state.pos = written;
-              }
-              stop = true;
-              break;
-          }
-        }
-      }
+    /**
+     * Driver which uses io_uring for reading and writing the terminals, so
+     * that output of all terminals is submitted and their input is received
+     * with a single system call. Input is read with multishot reads into a
+     * ring of buffers shared by all terminals, so reads don't need to be
+     * resubmitted after each event, and frames of output are written with
+     * linked writes which the kernel performs in order. Requires Linux 5.19
+     * or later. The terminals should be in blocking mode.
+     */
+    class io_uring_driver : public driver
+    {
+    public:
+      /**
+       * Constructs the driver. Bookkeeping of the terminals and their frames
+       * of output are allocated from given memory resource.
+       */
+      explicit io_uring_driver(
+        const line_callback_type& callback,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+      );
 
-      return c;
-    }
+      ~io_uring_driver();
+
+      /**
+       * Returns true if the driver was initialized successfully, which fails
+       * if io_uring or some of the features required by the driver are not
+       * supported by the kernel, or by the kernel headers the library was
+       * compiled with.
+       */
+      bool is_open() const;
+
+      /**
+       * Returns number of terminals being driven.
+       */
+      std::size_t size() const;
+
+      /**
+       * Begins prompting for lines on terminal with given file descriptor and
+       * size, using given prompt instance for editing them. The terminal is
+       * expected to be in raw mode. Returns false if an error occurs.
+       */
+      bool add(int fd,
+               prompt& editor,
+               const std::string& prompt,
+               std::size_t cols,
+               std::size_t rows);
+
+      /**
+       * Stops driving the terminal. Output not yet written to it is
+       * discarded. The file descriptor is not closed, but operations pending
+       * on it are canceled.
+       */
+      void remove(int fd);
+
+      /**
+       * Tells that the terminal has been resized.
+       */
+      void resize(int fd, std::size_t cols, std::size_t rows);
+
+      /**
+       * Submits output queued for the terminals, waits for completions for
+       * given number of milliseconds, or indefinitely if the timeout is
+       * negative, and processes them. Returns number of completions
+       * processed, or -1 on error.
+       */
+      int run_once(int timeout);
+
+    private:
+      struct impl;
+
+      std::unique_ptr<impl> m_impl;
+    };
+#endif
 
     /**
-     * Helper of refresh_single_line() and refresh_multi_line() to show hints
-     * to the right of the prompt.
+     * Session recorded with start_recording(), which can be replayed into a
+     * prompt to reproduce it, or to use it as a realistic workload in
+     * benchmarks.
      */
-    void show_hints(std::string& buffer, struct state& state)
+    class recording
     {
-      const auto plen = state.prompt.length();
-      char seq[64];
-      color col = color::none;
-      bool bold = false;
+    public:
+      /**
+       * Callback invoked with each line entered during the replay.
+       */
+      using line_callback_type = std::function<void(const value_type&)>;
 
-      if (!m_hints_callback || plen + state.len >= state.cols)
-      {
-        return;
-      }
+      /**
+       * Loads recording from given file into memory allocated from given
+       * memory resource.
+       */
+      explicit recording(
+        const std::string& path,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+      );
 
-      if (auto hint = (*m_hints_callback)(std::string(state.buf, state.len),
-                                          col,
-                                          bold))
-      {
-        const auto& value = hint.value();
-        auto hintlen = value.length();
-        auto hintmaxlen = state.cols - (plen + state.len);
-
-        if (hintlen > hintmaxlen)
-        {
-          hintlen = hintmaxlen;
-        }
-        if (bold && col == color::none)
-        {
-          col = color::white;
-        }
-        if (col != color::none || bold)
-        {
-          std::snprintf(
-            seq,
-            64,
-            "\033[%d;%d;49m",
-            bold ? 1 : 0,
-            static_cast<int>(col)
-          );
-        } else {
-          seq[0] = '\0';
-        }
-        buffer.append(seq, std::strlen(seq));
-        buffer.append(std::begin(value), std::begin(value) + hintlen);
-        if (col != color::none || bold)
-        {
-          buffer.append("\033[0m", 4);
-        }
-      }
-    }
+      /**
+       * Returns true if the recording was loaded successfully.
+       */
+      inline bool is_open() const
+      {
+        return m_open;
+      }
+
+      /**
+       * Feeds the recorded input to given prompt, beginning a new line and
+       * resizing the terminal as was done during the recording. Output
+       * meant for the terminal is appended to given string, which the
+       * callback may clear. If 'real_time' is true, the events are replayed
+       * at the pace they were recorded, otherwise as fast as possible.
+       * Returns the number of lines entered.
+       */
+      std::size_t replay(prompt& editor,
+                         bool real_time,
+                         const line_callback_type& callback,
+                         std::string& output) const;
+
+    private:
+      /**
+       * Reads variable length number from the recording. Returns false if
+       * the recording ends, or the number does not fit into 64 bits.
+       */
+      bool read_number(std::size_t& offset, std::uint64_t& value) const;
+
+    private:
+      bool m_open;
+      std::pmr::string m_data;
+    };
 
   private:
-    bool m_multi_line;
-    bool m_raw_mode;
-    ::termios m_original_termios;
-    std::size_t m_history_max_size;
-    history_container_type m_history_container;
-    std::optional<completion_callback_type> m_completion_callback;
-    std::optional<hints_callback_type> m_hints_callback;
+    struct impl;
+
+    std::unique_ptr<impl> m_impl;
   };
 }
 
+#if PEELO_PROMPT_HEADER_ONLY
+# include <peelo/prompt.ipp>
+#endif
+
 #endif /* !PEELO_PROMPT_HPP_GUARD */
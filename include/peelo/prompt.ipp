@@ -0,0 +1,7608 @@
+/*
+ * Copyright (c) 2010-2014, Salvatore Sanfilippo <antirez at gmail dot com>
+ * Copyright (c) 2010-2013, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ * Copyright (c) 2018-2020, peelo.net
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Implementation of peelo::prompt. By default this is included at the end
+ * of prompt.hpp. When PEELO_PROMPT_HEADER_ONLY is defined as 0, this is
+ * compiled only once into a library instead, and prompt.hpp contains just
+ * the declarations.
+ */
+#ifndef PEELO_PROMPT_IPP_GUARD
+#define PEELO_PROMPT_IPP_GUARD
+
+#include <peelo/prompt.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include <climits>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <unistd.h>
+#if defined(__linux__)
+# include <sys/epoll.h>
+# include <sys/mman.h>
+#endif
+#if !defined(PEELO_PROMPT_MAX_LINE)
+# define PEELO_PROMPT_MAX_LINE 4096
+#endif
+#if !defined(PEELO_PROMPT_DEFAULT_HISTORY_MAX_LEN)
+# define PEELO_PROMPT_DEFAULT_HISTORY_MAX_LEN 100
+#endif
+#if !defined(PEELO_PROMPT_PROBE_TIMEOUT)
+# define PEELO_PROMPT_PROBE_TIMEOUT 100
+#endif
+#if !defined(PEELO_PROMPT_LATE_REPORT_TIMEOUT)
+# define PEELO_PROMPT_LATE_REPORT_TIMEOUT 5000
+#endif
+#if !defined(PEELO_PROMPT_ESCAPE_TIMEOUT)
+# define PEELO_PROMPT_ESCAPE_TIMEOUT 50
+#endif
+#if !defined(PEELO_PROMPT_COMPLETION_MENU_ROWS)
+# define PEELO_PROMPT_COMPLETION_MENU_ROWS 10
+#endif
+#if !defined(PEELO_PROMPT_READ_AHEAD_CHUNK_SIZE)
+# define PEELO_PROMPT_READ_AHEAD_CHUNK_SIZE 65536
+#endif
+#if !defined(PEELO_PROMPT_READ_AHEAD_CHUNKS)
+# define PEELO_PROMPT_READ_AHEAD_CHUNKS 4
+#endif
+#if !defined(PEELO_PROMPT_READ_AHEAD_LINES)
+# define PEELO_PROMPT_READ_AHEAD_LINES 4096
+#endif
+#if !defined(PEELO_PROMPT_PATH_CACHE_SIZE)
+# define PEELO_PROMPT_PATH_CACHE_SIZE 64
+#endif
+#if !defined(PEELO_PROMPT_IO_URING)
+# if defined(__linux__) && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#   include <linux/io_uring.h>
+#  endif
+# endif
+// The driver uses buffer rings and cancellation by file descriptor, which
+// were introduced in Linux 5.19.
+# if defined(IORING_ASYNC_CANCEL_FD)
+#  define PEELO_PROMPT_IO_URING 1
+# else
+#  define PEELO_PROMPT_IO_URING 0
+# endif
+#endif
+#if !defined(PEELO_PROMPT_IO_URING_ENTRIES)
+# define PEELO_PROMPT_IO_URING_ENTRIES 1024
+#endif
+#if !defined(PEELO_PROMPT_IO_URING_BUFFERS)
+# define PEELO_PROMPT_IO_URING_BUFFERS 256
+#endif
+#if !defined(PEELO_PROMPT_IO_URING_BUFFER_SIZE)
+# define PEELO_PROMPT_IO_URING_BUFFER_SIZE 2048
+#endif
+#if PEELO_PROMPT_IO_URING
+# include <linux/io_uring.h>
+#endif
+
+namespace peelo
+{
+  /**
+   * Implementation of the prompt. Everything which depends on how the
+   * library was configured, such as the maximum length of the edited line,
+   * lives here, so that the layout of the prompt class does not.
+   */
+  struct prompt::impl
+  {
+    /** Bytes in the beginning of a recording file. */
+    static constexpr char recording_magic[] = "PPRC1";
+    static constexpr std::size_t recording_magic_length = 5;
+
+    /** Types of events in a recording. */
+    static constexpr std::uint64_t recording_input = 0;
+    static constexpr std::uint64_t recording_resize = 1;
+    static constexpr std::uint64_t recording_line = 2;
+
+    // Helpers used only by the implementation, which are defined below.
+    template<class T>
+    class spsc_queue;
+    class line_reader;
+    class thread_pool;
+    struct ranked_completion;
+    class trace_buffer;
+    class trace_scope;
+    class recorder;
+    struct speculation_result;
+
+    /**
+     * Returns the thread pool shared by all prompts.
+     */
+    static thread_pool& get_thread_pool();
+
+    /**
+     * Layout of the prompt on the screen. Since the prompt may contain escape
+     * sequences, such as colors, its length in bytes cannot be used as its
+     * width. This is computed once every time input is read, instead of
+     * during every refresh.
+     */
+    struct prompt_layout
+    {
+      explicit prompt_layout(std::pmr::memory_resource* resource);
+
+      /** Number of columns the prompt takes on the screen. */
+      std::size_t width;
+      /** Offsets and lengths of escape sequences in the prompt. */
+      std::pmr::vector<std::pair<std::size_t, std::size_t>> escapes;
+      /** Offsets where the prompt wraps to the next row of the screen. */
+      std::pmr::vector<std::size_t> breaks;
+    };
+
+    /**
+     * Layout of a single line of the edited text in multiline mode, where the
+     * text may contain newlines.
+     */
+    struct line_layout
+    {
+      /** Length of the line, excluding the newline. */
+      std::size_t length;
+      /** Number of rows the line takes on the screen. */
+      std::size_t rows;
+    };
+
+    /**
+     * Part of the edited text displayed on a single row of the screen in
+     * multiline mode.
+     */
+    struct visible_row
+    {
+      /** Offset of the text in the buffer. */
+      std::size_t offset;
+      /** Length of the text. */
+      std::size_t length;
+      /** Column where the text starts, after the prompt. */
+      std::size_t col;
+    };
+
+    /**
+     * Contents of the screen after a refresh in multiline mode, which the
+     * next refresh compares against in order to write only the changes.
+     */
+    struct screen_contents
+    {
+      explicit screen_contents(std::pmr::memory_resource* resource);
+
+      /** Whether the contents are known. */
+      bool valid;
+      /** First visible row of the edited text. */
+      std::size_t top;
+      /** Text displayed on each of the visible rows, excluding the prompt. */
+      std::pmr::vector<std::pmr::string> rows;
+      /** Hint displayed after the text. */
+      std::pmr::string hint;
+      /** Number of columns used by the hint. */
+      std::size_t hint_width;
+    };
+
+    /**
+     * The input state structure represents the state during line editing. We
+     * pass this state to functions implementing specific editing
+     * functionalities.
+     */
+    struct state
+    {
+      explicit state(std::pmr::memory_resource* resource);
+
+      /** Terminal stdin file descriptor. */
+      int ifd;
+      /** Terminal stdout file descriptor. */
+      int ofd;
+      /** Edited line buffer. */
+      char buf[PEELO_PROMPT_MAX_LINE];
+      /** Size of the line buffer. */
+      std::size_t buflen;
+      /** Prompt to display. */
+      std::pmr::string prompt;
+      /** Layout of the prompt. */
+      prompt_layout layout;
+      /** Layout of each line in the buffer. */
+      std::pmr::vector<line_layout> lines;
+      /** State of the lexer at the end of each line scanned so far. */
+      std::pmr::vector<lexer_state> checkpoints;
+      /** Words in the buffer. */
+      std::pmr::vector<token> tokens;
+      /** Current cursor position. */
+      std::size_t pos;
+      /** Offset of the first visible character (single line mode). */
+      std::size_t scroll;
+      /** Current edited line length. */
+      std::size_t len;
+      /** Number of columns in terminal. */
+      std::size_t cols;
+      /** Number of rows in terminal, or 0 if unknown. */
+      std::size_t rows;
+      /** First visible row of the edited text (multiline mode). */
+      std::size_t top;
+      /** Row of the cursor, relative to the first visible row. */
+      std::size_t cursor_row;
+      /**
+       * Column of the cursor. Number of columns in terminal means that the
+       * cursor is at the right margin waiting to wrap.
+       */
+      std::size_t cursor_col;
+      /** The history index we are currently editing. */
+      int history_index;
+      /** Whether refresh was skipped and the screen is out of date. */
+      bool refresh_pending;
+      /** Hint displayed after the buffer, including its escape sequences. */
+      std::pmr::string hint;
+      /** Contents of the screen after the previous refresh (multiline mode). */
+      screen_contents screen;
+      /** Whether an escape sequence is being read. */
+      bool escape;
+      /** Bytes of the escape sequence read so far, excluding the escape. */
+      char seq[3];
+      /** Number of bytes in the escape sequence read so far. */
+      std::size_t seq_len;
+      /** Completions being cycled through or shown in the menu. */
+      completion_container_type completions;
+      /** Whether the user is cycling through the completions. */
+      bool cycling;
+      /** Index of the completion shown while cycling. */
+      std::size_t completion_index;
+      /** Whether the completion menu is shown. */
+      bool menu_active;
+      /**
+       * Number of rows below the input taken by the completion menu, which
+       * the visible rows of the input are kept from overlapping (multiline
+       * mode).
+       */
+      std::size_t menu_rows;
+      /** String where output is appended to instead of writing it to 'ofd'. */
+      std::string* output;
+    };
+
+    /**
+     * Output of a single refresh. Instead of copying everything into a single
+     * string, the output is assembled as a list of buffers, where the prompt
+     * and the edited line are referenced in place and only the escape
+     * sequences and hints are copied. The whole list is then written to the
+     * terminal with a single writev() call.
+     */
+    class frame
+    {
+    public:
+      explicit frame(std::pmr::memory_resource* resource =
+                       std::pmr::get_default_resource());
+
+      /**
+       * Removes all output from the frame, while retaining the allocated
+       * memory for the next frame.
+       */
+      void clear();
+
+      /**
+       * Appends a copy of the given data to the frame.
+       */
+      void append(const char* data, std::size_t length);
+
+      /**
+       * Appends given number of copies of a character to the frame.
+       */
+      void append(std::size_t count, char c);
+
+      /**
+       * Appends a copy of the given string to the frame.
+       */
+      void append(std::string_view data);
+
+      /**
+       * Appends data to the frame without copying it. The data must remain
+       * valid until the frame has been written.
+       */
+      void reference(const char* data, std::size_t length);
+
+      /**
+       * Appends contents of the frame into given string.
+       */
+      void append_to(std::string& output) const;
+
+      /**
+       * Writes the frame into given file descriptor. Returns false if an
+       * error occurs.
+       */
+      bool write(int fd);
+
+    private:
+      /**
+       * Adds data about to be appended into the scratch buffer to the list of
+       * segments, either by extending the last segment or by adding a new
+       * one.
+       */
+      void add_scratch_segment(std::size_t length);
+
+      struct segment
+      {
+        /** Referenced data, or null if the data is in the scratch buffer. */
+        const char* data;
+        /** Offset of the data in the scratch buffer. */
+        std::size_t offset;
+        /** Length of the data. */
+        std::size_t length;
+      };
+
+      std::pmr::vector<segment> m_segments;
+      std::pmr::string m_scratch;
+      std::pmr::vector<::iovec> m_iovecs;
+    };
+
+    /**
+     * Column of the completion menu.
+     */
+    struct menu_column
+    {
+      /** Index of the first completion in the column. */
+      std::size_t first;
+      /** Width of the widest completion in the column. */
+      std::size_t width;
+    };
+
+    /**
+     * State of the completion menu.
+     */
+    struct menu
+    {
+      explicit menu(std::pmr::memory_resource* resource);
+
+      /** Number of rows in the menu. */
+      std::size_t height;
+      /** Row of the input below which the menu is shown. */
+      std::size_t bottom;
+      /** Length of the input omitted from the completions shown. */
+      std::size_t strip;
+      /** Index of the selected completion. */
+      std::size_t selected;
+      /** Index of the current page. */
+      std::size_t page;
+      /** Index of the first completion of each page laid out so far. */
+      std::pmr::vector<std::size_t> pages;
+      /** Columns of the current page. */
+      std::pmr::vector<menu_column> columns;
+      /** Index of the completion after the current page. */
+      std::size_t end;
+    };
+
+    /**
+     * Completions computed in the background before tab is pressed.
+     */
+    struct speculation
+    {
+      /** Version of the edited text the completions are computed for. */
+      std::uint64_t version;
+      /** Cursor position the completions are computed for. */
+      std::size_t pos;
+      /** The completions, shared with the thread computing them. */
+      std::shared_ptr<speculation_result> result;
+    };
+
+    explicit impl(std::pmr::memory_resource* resource);
+
+    ~impl();
+
+    impl(const impl&) = delete;
+    impl(impl&&) = delete;
+    void operator=(const impl&) = delete;
+    void operator=(impl&&) = delete;
+
+    // Implementations of the public member functions of the prompt.
+    value_type input(const std::string& prompt);
+    bool input_into(const std::string& prompt, std::string& output);
+    std::optional<std::string_view> input_view(const std::string& prompt);
+    void clear_screen();
+    void begin_session(const std::string& prompt,
+                       std::size_t cols,
+                       std::size_t rows,
+                       std::string& output);
+    feed_status feed(const char* data,
+                     std::size_t length,
+                     std::string& output,
+                     std::size_t& consumed,
+                     std::string& line);
+    void resize_session(std::size_t cols,
+                        std::size_t rows,
+                        std::string& output);
+    bool add_to_history(const std::string& line);
+    void set_history_max_size(std::size_t size);
+    void set_completion_callback(
+      const std::optional<completion_callback_type>& callback
+    );
+    void set_completion_callback(
+      const vector_completion_callback_type& callback
+    );
+    void set_hints_callback(
+      const std::optional<hints_callback_type>& callback
+    );
+    bool start_recording(const std::string& path);
+    void stop_recording();
+    void set_tracing(std::size_t capacity, const std::string& path);
+
+    /**
+     * Looks up the terminal name from the environment and compares it against
+     * list of terminals that are not able to understand basic escape
+     * sequences.
+     */
+    static bool is_unsupported_term_name();
+
+    /**
+     * This function is called when input() is called with the standard input
+     * file descriptor not attached to a TTY. So for example when the program
+     * using this library is called in pipe or with a file redirected to it's
+     * standard input. In this case, we want to be able to return the line
+     * regardless of it's length.
+     */
+    template<class String>
+    static bool input_no_tty(String& line);
+
+    /**
+     * Reads the next line into given buffer, or just points the view to it
+     * if the line is already available in memory. Returns false at end of
+     * input.
+     */
+    template<class String>
+    bool read_line(const std::string& prompt,
+                   String& buffer,
+                   std::string_view& line);
+
+    /**
+     * This function is called instead of input_no_tty() when read ahead is
+     * enabled. The next line is taken from the lines already read by the
+     * background thread, which is started when this is called for the first
+     * time.
+     */
+    bool input_read_ahead(std::string_view& line);
+
+    /**
+     * This function calls the line editing function edit() using the STDIN
+     * file descriptor set in raw mode.
+     */
+    template<class String>
+    bool input_raw(const std::string& prompt, String& line);
+
+    /**
+     * This function is the core of the line editing capability of this
+     * library. It expects 'fd' to be already in "raw mode" so that every key
+     * pressed will be returned ASAP to read().
+     *
+     * The resulting string is stored into 'line' when the user types enter,
+     * or when ^D is typed. Returns false if no line was entered.
+     */
+    template<class String>
+    bool edit(int stdin_fd,
+              int stdout_fd,
+              const std::string& prompt,
+              String& line);
+
+    /**
+     * Initializes the input state for editing a new line on terminal with
+     * given size.
+     */
+    void begin_state(struct state& state,
+                     int ifd,
+                     int ofd,
+                     const std::string& prompt,
+                     std::size_t cols,
+                     std::size_t rows);
+
+    /**
+     * Processes a single byte of input. Returns true once the user has
+     * entered the line in the buffer, false if editing was canceled or end
+     * of input was reached, or no value if editing continues.
+     */
+    std::optional<bool> process(struct state& state, char c);
+
+    /**
+     * Asks the callback whether the edited text is a complete input.
+     */
+    bool is_input_complete(struct state& state);
+
+    /**
+     * Appends output to the string given to the session, or writes it to the
+     * terminal. Returns false if an error occurs.
+     */
+    bool write_output(struct state& state,
+                      const char* data,
+                      std::size_t length);
+
+    /**
+     * Appends frame of output to the string given to the session, or writes
+     * it to the terminal. Returns false if an error occurs.
+     */
+    bool write_frame(struct state& state, frame& buffer);
+
+    /**
+     * Raw mode: 1960 magic shit.
+     */
+    bool enable_raw_mode(int fd);
+
+    void disable_raw_mode(int fd);
+
+    /**
+     * Calls the two low level functions refresh_single_line() or
+     * refresh_multi_line() according to the selected mode. Unless forced,
+     * the frame is dropped when more input is pending and the terminal is
+     * still busy with the previous frames.
+     */
+    void refresh(struct state& state, bool force = false);
+
+    /**
+     * Begins a new frame of output in the given buffer. If the terminal
+     * supports synchronized output, it's told to hold off rendering until the
+     * whole frame has been received, so that intermediate states of the
+     * refresh are never displayed.
+     */
+    void begin_frame(frame& buffer) const;
+
+    /**
+     * Ends frame of output that was started with begin_frame().
+     */
+    void end_frame(frame& buffer) const;
+
+    /**
+     * Computes layout of the prompt on terminal with given number of columns.
+     * Escape sequences, bytes enclosed between \001 and \002 (as used by
+     * readline) and other control characters take no space on the screen.
+     * UTF-8 encoded characters are counted as one column wide.
+     */
+    static void compute_prompt_layout(std::string_view prompt,
+                                      std::size_t cols,
+                                      prompt_layout& layout);
+
+    /**
+     * Single line low level line refresh.
+     *
+     * Rewrite the currently edited line accordingly to the buffer content,
+     * cursor position and number of columns of the terminal.
+     */
+    void refresh_single_line(struct state& state);
+
+    /**
+     * Multi line low level line refresh.
+     *
+     * Rewrite the currently edited text accordingly to the buffer content,
+     * cursor position and number of columns of the terminal. Every line of
+     * the text starts from a new row. When the text does not fit on the
+     * screen, only the rows around the cursor which fit on the screen are
+     * rendered. When the visible rows are the same as in the previous
+     * refresh, only the rows which have changed since then are rewritten.
+     */
+    void refresh_multi_line(struct state& state);
+
+    /**
+     * Helper of refresh_multi_line() which compares the visible rows against
+     * what was written to the screen in the previous refresh, and rewrites
+     * only the rows which have changed, starting from the first changed
+     * character. Rows which have not changed are never touched.
+     */
+    void refresh_changed_rows(struct state& state,
+                              std::size_t hint_row,
+                              std::size_t hint_width);
+
+    /**
+     * Helper of refresh_multi_line() which writes given visible row, including
+     * the part of the prompt on it. Escape sequences of the prompt preceding
+     * the first visible row, such as colors, are also written so that the
+     * rest of the prompt looks as it should.
+     */
+    void write_row(const struct state& state, std::size_t index, bool hint);
+
+    /**
+     * Collects parts of the buffer displayed on each of the visible rows,
+     * starting from the first visible row.
+     */
+    static void get_visible_rows(const struct state& state,
+                                 std::size_t height,
+                                 std::pmr::vector<visible_row>& visible);
+
+    /**
+     * Returns the row and column of given offset in the buffer, relative to
+     * the beginning of the prompt.
+     */
+    static std::pair<std::size_t, std::size_t> locate(
+      const struct state& state,
+      std::size_t offset
+    );
+
+    /**
+     * Returns index of the line containing given offset in the buffer, and
+     * the offset where the line begins.
+     */
+    static std::pair<std::size_t, std::size_t> find_line(
+      const struct state& state,
+      std::size_t offset
+    );
+
+    /**
+     * Called by the editing functions after the range of 'removed' bytes at
+     * given offset of the buffer has been replaced with 'inserted' bytes.
+     */
+    void buffer_changed(struct state& state,
+                        std::size_t offset,
+                        std::size_t removed,
+                        std::size_t inserted);
+
+    /**
+     * Returns view to the edited text given to the callbacks.
+     */
+    static input_context get_context(const struct state& state);
+
+    /**
+     * Updates the words in the buffer after part of it has been replaced.
+     * Splitting starts from the word touched by the replacement, and stops
+     * as soon as it arrives at a word after the replacement which was found
+     * before it, since the rest of the words remain the same.
+     */
+    static void update_tokens(struct state& state,
+                              std::size_t offset,
+                              std::size_t removed,
+                              std::size_t inserted);
+
+    /**
+     * Returns offset where the word beginning at given offset of the buffer
+     * ends.
+     */
+    static std::size_t scan_token(const struct state& state, std::size_t pos);
+
+    /**
+     * Returns state of the lexer at the end of the buffer. Scanning continues
+     * from the last line whose state is known, and the states at the end of
+     * the lines scanned are stored for the next time.
+     */
+    static lexer_state lex(struct state& state);
+
+    /**
+     * Updates layout of the lines in the buffer after part of it has been
+     * replaced. Only the lines touched by the replacement are laid out again.
+     */
+    static void update_lines(struct state& state,
+                             std::size_t offset,
+                             std::size_t removed,
+                             std::size_t inserted);
+
+    /**
+     * Appends to the buffer the shortest sequence of bytes that moves the
+     * cursor from one position to another, in the same manner as cost model
+     * of ncurses does. Rows are relative and columns are zero based. Column
+     * equal to number of columns in the terminal means that the cursor is at
+     * the right margin waiting to wrap, where terminals disagree on the
+     * cursor position, so only absolute horizontal movement is used from it.
+     */
+    static void move_cursor(frame& buffer,
+                            std::size_t cols,
+                            std::size_t from_row,
+                            std::size_t from_col,
+                            std::size_t to_row,
+                            std::size_t to_col);
+
+    /**
+     * Returns length of control sequence with a single numeric parameter.
+     * Parameter of 1 is omitted, as it's the default.
+     */
+    static std::size_t csi_length(std::size_t n);
+
+    /**
+     * Appends control sequence with a single numeric parameter to the buffer.
+     */
+    static void append_csi(frame& buffer, std::size_t n, char final);
+
+    /**
+     * Use the ESC [6n escape sequence to query the horizontal cursor position
+     * and return it. On error, -1 is returned, on success the position of the
+     * cursor.
+     */
+    static int get_cursor_position(int ifd, int ofd);
+
+    /**
+     * Queries the terminal for optional features that we can take advantage
+     * of. All of the queries are sent in a single write and the answers are
+     * collected with a single timed wait:
+     *
+     * - DECRQM for bracketed paste (DEC private mode 2004) and synchronized
+     *   output (DEC private mode 2026).
+     * - Progressive enhancement flags of the kitty keyboard protocol.
+     * - XTVERSION for name and version of the terminal.
+     * - Primary device attributes, which every VT100 compatible terminal
+     *   answers. Since it's sent last, we know when to stop waiting for the
+     *   answers even when the other ones never arrive.
+     *
+     * Anything else read from the terminal while waiting for the answers is
+     * input typed ahead by the user, which is stored so that the editing
+     * functions will see it. If the device attributes report has not arrived
+     * by the timeout, for example over a slow connection, read_input()
+     * keeps filtering out the answers until it does.
+     */
+    void probe_terminal(int ifd, int ofd);
+
+    /**
+     * Parses the answers to the queries sent by probe_terminal() from input
+     * received from the terminal, and moves everything else to the pending
+     * input. What might be the beginning of an answer is left at the end of
+     * the received input, until the rest of it arrives.
+     */
+    void filter_reports();
+
+    /**
+     * Stops waiting for the rest of an answer received partially. If it
+     * cannot be anything else than an answer, it has been cut off and is
+     * dropped. Otherwise it's passed to the editing functions as input.
+     */
+    void end_partial_report();
+
+    /**
+     * Updates terminal capabilities from a single report received as an
+     * answer to the queries sent by probe_terminal().
+     */
+    void parse_report(std::string_view report);
+
+    /**
+     * Returns length of the report at given offset of the input received from
+     * the terminal, or 0 if there isn't one. Recognized reports are private
+     * mode reports, kitty keyboard protocol flags and device attributes in
+     * form of CSI ? params final, and XTVERSION in form of DCS > | text ST.
+     */
+    static std::size_t report_length(std::string_view input,
+                                     std::size_t offset);
+
+    /**
+     * Returns true if the input from given offset to its end could be the
+     * beginning of a report recognized by report_length().
+     */
+    static bool is_partial_report(std::string_view input,
+                                  std::size_t offset);
+
+    /**
+     * Try to get the number of rows in the current terminal, or return 0 if
+     * it fails.
+     */
+    static std::size_t get_rows(int ofd);
+
+    /**
+     * Try to get the number of columns in the current terminal, or assume 80
+     * if it fails.
+     */
+    static int get_columns(int ifd, int ofd);
+
+    /**
+     * Reads single byte of input. Input typed ahead while the terminal was
+     * being queried is consumed first, before reading from the given file
+     * descriptor, and answers to the queries arriving late are filtered
+     * out. Return value follows the semantics of read().
+     */
+    ssize_t read_input(int fd, char& c);
+
+    /**
+     * Returns true if there is input that can be read without blocking.
+     */
+    bool has_pending_input(int fd, int timeout = 0) const;
+
+    /**
+     * Returns true if the terminal has not yet drained output written to it
+     * earlier, which happens with slow serial lines, congested network
+     * connections or when output has been stopped with XOFF.
+     */
+    static bool is_output_congested(int fd);
+
+    /**
+     * Beep, used for completion when there is nothing to complete or when all
+     * the choices were already shown.
+     */
+    static void beep(struct state& state);
+
+    /**
+     * Insert the character 'c' at cursor's current position. On error writing
+     * to the terminal, false is returned, otherwise true.
+     */
+    bool insert(struct state& state, char c);
+
+    /**
+     * Move cursor on the left.
+     */
+    void move_left(struct state& state);
+
+    /**
+     * Move cursor on the right.
+     */
+    void move_right(struct state& state);
+
+    /**
+     * Move cursor to the start of the line.
+     */
+    void move_home(struct state& state);
+
+    /**
+     * Move cursor to the end of the line.
+     */
+    void move_end(struct state& state);
+
+    /**
+     * Move cursor to the previous or next line of the buffer, as specified by
+     * 'direction', keeping the column if possible. If there is no such line,
+     * history is browsed instead.
+     */
+    void move_vertical(struct state& state, bool direction);
+
+    /**
+     * Substitute the currently edited line with the next or previous history
+     * entry as specified by 'direction'.
+     */
+    void edit_history_next(struct state& state, bool direction);
+
+    /**
+     * Delete the character at the right of the cursor without altering the
+     * cursor position. Basically this is what happens with the "Delete"
+     * keyboard key.
+     */
+    void delete_next_char(struct state& state);
+
+    /**
+     * Backspace implementation.
+     */
+    void delete_previous_char(struct state& state);
+
+    /**
+     * Delete the previous word, maintaining the cursor at the start of the
+     * current word.
+     */
+    void delete_previous_word(struct state& state);
+
+    /**
+     * Swaps current character with previous one.
+     */
+    void transpose_characters(struct state& state);
+
+    /**
+     * Deletes characters from beginning of line to current position.
+     */
+    void kill_line(struct state& state);
+
+    /**
+     * Deletes characters from current position to end of line.
+     */
+    void kill_end_of_line(struct state& state);
+
+    /**
+     * Read the next two bytes representing the escape sequence. Use two calls
+     * to handle slow terminals returning the two characters at different
+     * times.
+     */
+    void handle_esc(struct state& state);
+
+    /**
+     * This is an helper function for edit() and is called when the user
+     * types the <tab> key in order to complete the string currently in the
+     * input. The completions are either shown in a menu, or the user can
+     * cycle through them by pressing <tab> again.
+     *
+     * The state of the editing is encapsulated into the pointed input state
+     * structure as described in the structure definition.
+     */
+    void start_completion(struct state& state);
+
+    /**
+     * Shows the completion cycled to in place of the input, or the original
+     * input after the last completion.
+     */
+    void show_completion(struct state& state);
+
+    /**
+     * Handles a key pressed while cycling through the completions. Returns
+     * true if the key was consumed, or false if cycling ended and the key
+     * should be processed as usual.
+     */
+    bool cycle_key(struct state& state, char c);
+
+    /**
+     * Replaces the edited text with given text, moving the cursor to the end
+     * of it.
+     */
+    void set_buffer(struct state& state, std::string_view text);
+
+    /**
+     * Scores the completions against the word under the cursor, and replaces
+     * them with at most 'limit' best matching ones in order of their score.
+     * The completions are divided into chunks, and the best matches of each
+     * chunk are selected in parallel, after which the best matches of all
+     * chunks are selected. Only partial sorting is needed for both.
+     */
+    void rank_completions(const struct state& state,
+                          completion_container_type& completions,
+                          std::size_t limit);
+
+    /**
+     * Returns score of how well the text matches the pattern, or -1 if the
+     * text does not contain all characters of the pattern in the same order,
+     * ignoring case. Matches at the beginning of words, consecutive matches
+     * and matches with the same case score higher.
+     */
+    static int fuzzy_score(std::string_view pattern, std::string_view text);
+
+    /**
+     * Shows the completions in a menu below the input, from which the user
+     * can choose one of them. The menu is divided into pages that fit on the
+     * screen, and only the completions on the current page are ever looked
+     * at, so the cost of showing the menu does not depend on the number of
+     * completions.
+     */
+    void open_menu(struct state& state);
+
+    /**
+     * Handles a key pressed while the completion menu is shown. Returns true
+     * if the key was consumed, or false if the selected completion was
+     * accepted and the key should be processed as usual.
+     */
+    bool menu_key(struct state& state, char c);
+
+    /**
+     * Handles an escape sequence read while the completion menu is shown.
+     */
+    void menu_escape(struct state& state);
+
+    /**
+     * Selects given completion from the menu, moving to the page containing
+     * it if needed. Pages are laid out from the beginning, so the previous
+     * pages are always known.
+     */
+    void select_menu_item(struct state& state, std::size_t selected);
+
+    /**
+     * Closes the completion menu without accepting any of the completions.
+     */
+    void close_menu(struct state& state);
+
+    /**
+     * Lays out page of the completion menu beginning from given completion.
+     * Completions are placed in columns from top to bottom, and as many
+     * columns are added as fit on the screen, each as wide as the widest
+     * completion in it.
+     */
+    void layout_menu_page(const struct state& state,
+                          menu& m,
+                          std::size_t first) const;
+
+    /**
+     * Displays current page of the completion menu below the input.
+     */
+    void draw_menu(struct state& state, const menu& m);
+
+    /**
+     * Removes the completion menu from the screen.
+     */
+    void clear_menu(struct state& state, const menu& m);
+
+    /**
+     * Returns the text of a completion shown to the user. Since completions
+     * replace the whole input, the given length of the input preceding the
+     * completed word is left out.
+     */
+    static std::string_view get_completion_label(
+      const struct state& state,
+      std::string_view completion,
+      std::size_t strip
+    );
+
+    /**
+     * Appends at most given number of columns of a completion to the buffer,
+     * leaving out control characters. Returns the number of columns used. If
+     * no buffer is given, only the number of columns is computed.
+     */
+    static std::size_t append_menu_label(frame* buffer,
+                                         std::string_view label,
+                                         std::size_t max_width);
+
+    /**
+     * Waits for the user to stop typing, and then starts computing
+     * completions for the edited text on a background thread, unless they are
+     * already being computed or too many computations are already running.
+     * Computations for text which has since been edited are canceled, and
+     * discarded once they have finished. Does nothing unless speculative
+     * completion is enabled and the completions are not already shown.
+     */
+    void speculate(const struct state& state);
+
+    /**
+     * Returns the speculative completion computed for the edited text and
+     * cursor position, if any.
+     */
+    std::pmr::vector<speculation>::iterator find_speculation(
+      const struct state& state
+    );
+
+    /**
+     * Helper of refresh_single_line() and refresh_multi_line() to show hints
+     * to the right of the prompt. The hint, including the escape sequences
+     * for its color, is stored into the given buffer. Returns the number of
+     * columns used by the hint.
+     */
+    std::size_t show_hints(std::pmr::string& buffer, struct state& state);
+
+    /**
+     * Implementation of dump_trace(), which is also used for writing the
+     * trace when the prompt is destroyed.
+     */
+    bool write_trace(const char* path) const;
+
+    std::pmr::memory_resource* const m_resource;
+    bool m_multi_line;
+    bool m_completion_menu;
+    bool m_read_ahead;
+    std::unique_ptr<line_reader> m_line_reader;
+    std::pmr::string m_line;
+    bool m_raw_mode;
+    bool m_terminal_probed;
+    terminal_capabilities m_capabilities;
+    std::pmr::string m_pending_input;
+    bool m_awaiting_reports;
+    std::chrono::steady_clock::time_point m_reports_deadline;
+    std::pmr::string m_report_input;
+    frame m_frame;
+    std::pmr::vector<visible_row> m_visible_rows;
+    menu m_menu;
+    std::uint64_t m_buffer_version;
+    std::optional<std::chrono::milliseconds> m_speculation_delay;
+    std::size_t m_speculation_limit;
+    std::pmr::vector<speculation> m_speculations;
+    std::pmr::vector<std::shared_ptr<speculation_result>>
+      m_canceled_speculations;
+    std::optional<std::size_t> m_ranking_limit;
+    std::unique_ptr<struct state> m_session;
+    bool m_session_active;
+    std::shared_ptr<trace_buffer> m_trace;
+    std::unique_ptr<recorder> m_recorder;
+    std::pmr::string m_trace_path;
+    ::termios m_original_termios;
+    std::size_t m_history_max_size;
+    history_container_type m_history_container;
+    std::optional<token_completion_callback_type> m_completion_callback;
+    std::optional<token_hints_callback_type> m_hints_callback;
+    std::optional<input_complete_callback_type> m_input_complete_callback;
+  };
+
+  /**
+   * Bounded lock free queue between a single producer thread and a single
+   * consumer thread. Threads spin for a while when the queue is full or
+   * empty, after which they go to sleep until the other thread wakes them
+   * up.
+   */
+  template<class T>
+  class prompt::impl::spsc_queue
+  {
+  public:
+    explicit spsc_queue(std::size_t capacity)
+      : m_slots(capacity + 1)
+      , m_head(0)
+      , m_tail(0)
+      , m_sleepers(0)
+      , m_closed(false) {}
+
+    spsc_queue(const spsc_queue&) = delete;
+    spsc_queue(spsc_queue&&) = delete;
+    void operator=(const spsc_queue&) = delete;
+    void operator=(spsc_queue&&) = delete;
+
+    /**
+     * Adds value to the queue, waiting while the queue is full. Returns
+     * false if the queue has been closed.
+     */
+    bool push(const T& value)
+    {
+      const auto tail = m_tail.load(std::memory_order_relaxed);
+      const auto next = (tail + 1) % m_slots.size();
+
+      if (!wait([&]() { return next != m_head.load(); }))
+      {
+        return false;
+      }
+      m_slots[tail] = value;
+      m_tail.store(next);
+      wake();
+
+      return true;
+    }
+
+    /**
+     * Removes value from the queue, waiting while the queue is empty.
+     * Returns false if the queue has been closed.
+     */
+    bool pop(T& value)
+    {
+      const auto head = m_head.load(std::memory_order_relaxed);
+
+      if (!wait([&]() { return head != m_tail.load(); }))
+      {
+        return false;
+      }
+      value = m_slots[head];
+      m_head.store((head + 1) % m_slots.size());
+      wake();
+
+      return true;
+    }
+
+    /**
+     * Closes the queue, waking up threads waiting on it.
+     */
+    void close()
+    {
+      m_closed.store(true);
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+
+      m_condition.notify_all();
+    }
+
+  private:
+    template<class Predicate>
+    bool wait(Predicate ready)
+    {
+      for (int i = 0; i < 100; ++i)
+      {
+        if (m_closed.load())
+        {
+          return false;
+        }
+        else if (ready())
+        {
+          return true;
+        }
+        std::this_thread::yield();
+      }
+
+      std::unique_lock<std::mutex> lock(m_mutex);
+
+      ++m_sleepers;
+      m_condition.wait(lock, [&]() { return m_closed.load() || ready(); });
+      --m_sleepers;
+
+      return !m_closed.load();
+    }
+
+    void wake()
+    {
+      if (m_sleepers.load() > 0)
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_condition.notify_all();
+      }
+    }
+
+    std::vector<T> m_slots;
+    std::atomic<std::size_t> m_head;
+    std::atomic<std::size_t> m_tail;
+    std::atomic<int> m_sleepers;
+    std::atomic<bool> m_closed;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+  };
+
+  /**
+   * Reads lines from a file descriptor on a background thread, so that
+   * reading the next lines overlaps with processing of the previous ones.
+   * Input is read in large chunks, and the lines are handed over as views
+   * to the chunks, without copying them. Chunks are recycled once all of
+   * their lines have been consumed, so the amount of memory used is
+   * bounded.
+   */
+  class prompt::impl::line_reader
+  {
+  public:
+    explicit line_reader(int fd)
+      : m_fd(fd)
+      , m_lines(PEELO_PROMPT_READ_AHEAD_LINES)
+      , m_free(PEELO_PROMPT_READ_AHEAD_CHUNKS)
+      , m_finished(false)
+    {
+      if (::pipe(m_wake) == -1)
+      {
+        m_wake[0] = m_wake[1] = -1;
+      }
+      for (auto& c : m_chunks)
+      {
+        c.data.resize(PEELO_PROMPT_READ_AHEAD_CHUNK_SIZE);
+        m_free.push(&c);
+      }
+      m_thread = std::thread([this]() { produce(); });
+    }
+
+    ~line_reader()
+    {
+      // Interrupt the thread if it's waiting for input or for lines to be
+      // consumed.
+      if (m_wake[1] != -1 && ::write(m_wake[1], "", 1) < 0)
+      {
+      }
+      m_lines.close();
+      m_free.close();
+      m_thread.join();
+      for (const auto fd : m_wake)
+      {
+        if (fd != -1)
+        {
+          ::close(fd);
+        }
+      }
+    }
+
+    line_reader(const line_reader&) = delete;
+    line_reader(line_reader&&) = delete;
+    void operator=(const line_reader&) = delete;
+    void operator=(line_reader&&) = delete;
+
+    /**
+     * Waits for the next line, excluding the newline. Returns false once
+     * end of input has been reached. The line remains valid until this is
+     * called again.
+     */
+    bool next(std::string_view& line)
+    {
+      entry e;
+
+      while (!m_finished && m_lines.pop(e))
+      {
+        if (e.release)
+        {
+          // All the lines in the chunk have been consumed.
+          m_free.push(e.release);
+        }
+        else if (e.data)
+        {
+          line = std::string_view(e.data, e.length);
+
+          return true;
+        } else {
+          break;
+        }
+      }
+      m_finished = true;
+
+      return false;
+    }
+
+  private:
+    struct chunk
+    {
+      std::vector<char> data;
+    };
+
+    /**
+     * Entry in the queue of lines. Besides lines, the queue contains
+     * markers telling that the lines of a chunk have all been consumed and
+     * that end of input has been reached.
+     */
+    struct entry
+    {
+      /** Beginning of the line, or null if this is a marker. */
+      const char* data;
+      /** Length of the line. */
+      std::size_t length;
+      /** Chunk to be recycled, or null if end of input. */
+      chunk* release;
+    };
+
+    /**
+     * Body of the background thread. Reads input into a chunk and adds the
+     * complete lines found in it into the queue. Once the chunk is full,
+     * the incomplete line at the end of the chunk is moved into the next
+     * chunk, unless the chunk contains no complete lines, in which case it
+     * is enlarged instead.
+     */
+    void produce()
+    {
+      chunk* current;
+      std::size_t used = 0;
+      std::size_t start = 0;
+
+      if (!m_free.pop(current))
+      {
+        return;
+      }
+      for (;;)
+      {
+        if (used == current->data.size())
+        {
+          chunk* next;
+
+          if (start == 0)
+          {
+            current->data.resize(current->data.size() * 2);
+          }
+          else if (!m_lines.push({ nullptr, 0, current })
+                   || !m_free.pop(next))
+          {
+            return;
+          } else {
+            if (next->data.size() < used - start)
+            {
+              next->data.resize(current->data.size());
+            }
+            std::memmove(
+              next->data.data(),
+              current->data.data() + start,
+              used - start
+            );
+            current = next;
+            used -= start;
+            start = 0;
+          }
+        }
+
+        const auto count = read(current->data.data() + used,
+                                current->data.size() - used);
+
+        if (count <= 0)
+        {
+          if (count == 0 && used > start)
+          {
+            m_lines.push({
+              current->data.data() + start,
+              used - start,
+              nullptr
+            });
+          }
+          m_lines.push({ nullptr, 0, nullptr });
+
+          return;
+        }
+        for (auto end = used + count; used < end; ++used)
+        {
+          if (current->data[used] == '\n')
+          {
+            if (!m_lines.push({
+              current->data.data() + start,
+              used - start,
+              nullptr
+            }))
+            {
+              return;
+            }
+            start = used + 1;
+          }
+        }
+      }
+    }
+
+    /**
+     * Reads input, waiting until some is available. Returns 0 at end of
+     * input, or when the reader is being destroyed.
+     */
+    ssize_t read(char* buffer, std::size_t size)
+    {
+      ::pollfd fds[2] = {
+        { m_fd, POLLIN, 0 },
+        { m_wake[0], POLLIN, 0 }
+      };
+
+      for (;;)
+      {
+        if (::poll(fds, m_wake[0] != -1 ? 2 : 1, -1) < 0)
+        {
+          if (errno == EINTR)
+          {
+            continue;
+          }
+
+          return -1;
+        }
+        if (fds[1].revents)
+        {
+          return -1;
+        }
+
+        const auto count = ::read(m_fd, buffer, size);
+
+        if (count >= 0 || errno != EINTR)
+        {
+          return count;
+        }
+      }
+    }
+
+    const int m_fd;
+    int m_wake[2];
+    chunk m_chunks[PEELO_PROMPT_READ_AHEAD_CHUNKS];
+    spsc_queue<entry> m_lines;
+    spsc_queue<chunk*> m_free;
+    bool m_finished;
+    std::thread m_thread;
+  };
+
+  /**
+   * Fixed size pool of threads, which run tasks given to them in parallel.
+   */
+  class prompt::impl::thread_pool
+  {
+  public:
+    explicit thread_pool(std::size_t size)
+      : m_stop(false)
+    {
+      m_threads.reserve(size);
+      for (std::size_t i = 0; i < size; ++i)
+      {
+        try
+        {
+          m_threads.emplace_back([this]() { work(); });
+        }
+        catch (const std::exception&)
+        {
+          // Run with the threads started so far, if no more can be.
+          break;
+        }
+      }
+    }
+
+    ~thread_pool()
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_stop = true;
+      }
+      m_condition.notify_all();
+      for (auto& thread : m_threads)
+      {
+        thread.join();
+      }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool(thread_pool&&) = delete;
+    void operator=(const thread_pool&) = delete;
+    void operator=(thread_pool&&) = delete;
+
+    /**
+     * Returns the number of threads in the pool.
+     */
+    inline std::size_t size() const
+    {
+      return m_threads.size();
+    }
+
+    /**
+     * Calls the given function with every index from 0 to count - 1 in
+     * the threads of the pool, and waits until all of the calls have
+     * returned. If any of the calls throws, the first exception thrown is
+     * rethrown once all of them have returned.
+     */
+    void run(std::size_t count, const std::function<void(std::size_t)>& fn)
+    {
+      std::mutex mutex;
+      std::condition_variable done;
+      std::exception_ptr error;
+      auto remaining = count;
+
+      if (m_threads.empty())
+      {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+          fn(i);
+        }
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+          // The tasks already queued refer to the variables above, so
+          // they are waited for even if queuing the rest fails.
+          try
+          {
+            m_tasks.push_back([&, i]()
+            {
+              std::exception_ptr thrown;
+
+              try
+              {
+                fn(i);
+              }
+              catch (...)
+              {
+                thrown = std::current_exception();
+              }
+
+              std::lock_guard<std::mutex> lock(mutex);
+
+              if (thrown && !error)
+              {
+                error = thrown;
+              }
+              if (--remaining == 0)
+              {
+                done.notify_one();
+              }
+            });
+          }
+          catch (...)
+          {
+            error = std::current_exception();
+            remaining = i;
+            break;
+          }
+        }
+      }
+      m_condition.notify_all();
+
+      std::unique_lock<std::mutex> lock(mutex);
+
+      done.wait(lock, [&remaining]() { return remaining == 0; });
+      if (error)
+      {
+        std::rethrow_exception(error);
+      }
+    }
+
+  private:
+    void work()
+    {
+      for (;;)
+      {
+        std::function<void()> task;
+
+        {
+          std::unique_lock<std::mutex> lock(m_mutex);
+
+          m_condition.wait(lock, [this]()
+          {
+            return m_stop || !m_tasks.empty();
+          });
+          if (m_tasks.empty())
+          {
+            return;
+          }
+          task = std::move(m_tasks.front());
+          m_tasks.pop_front();
+        }
+        task();
+      }
+    }
+
+    bool m_stop;
+    std::vector<std::thread> m_threads;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+  };
+
+  /**
+   * Completion with its score, used when ranking completions.
+   */
+  struct prompt::impl::ranked_completion
+  {
+    /** Negated score, so that the best match is sorted first. */
+    int score;
+    /** Length of the completion, shorter of equal matches is better. */
+    std::size_t length;
+    /** Index of the completion. */
+    std::size_t index;
+
+    inline bool operator<(const ranked_completion& that) const
+    {
+      if (score != that.score)
+      {
+        return score < that.score;
+      }
+      else if (length != that.length)
+      {
+        return length < that.length;
+      }
+
+      return index < that.index;
+    }
+  };
+
+  /**
+   * Completions computed speculatively on a background thread. Shared
+   * between the thread and the prompt, so that the prompt can abandon them
+   * without waiting for the thread.
+   */
+  struct prompt::impl::speculation_result
+  {
+    /** Set when the completions are no longer needed. */
+    std::atomic<bool> canceled{false};
+    std::mutex mutex;
+    std::condition_variable condition;
+    /** Whether the completion callback has returned. */
+    bool done = false;
+    completion_container_type completions;
+    /** Exception thrown by the completion callback, if any. */
+    std::exception_ptr error;
+    /** Thread calling the completion callback. */
+    std::thread thread;
+  };
+
+  /**
+   * Lock free ring buffer of timed events, recorded from any thread. Once
+   * the buffer is full, the oldest events are overwritten.
+   */
+  class prompt::impl::trace_buffer
+  {
+  public:
+    explicit trace_buffer(std::size_t capacity)
+      : m_capacity(capacity)
+      , m_events(std::make_unique<event[]>(capacity))
+      , m_next(0) {}
+
+    /**
+     * Returns current time in nanoseconds.
+     */
+    static std::uint64_t now()
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+      ).count();
+    }
+
+    /**
+     * Records event which began at given time and ended now, with
+     * optional integer argument, or -1 if the event has none. Name of the
+     * event must be a string literal.
+     */
+    void record(const char* name, std::uint64_t start, std::int64_t argument)
+    {
+      const auto end = now();
+      const auto index = m_next.fetch_add(1, std::memory_order_relaxed);
+      auto& e = m_events[index % m_capacity];
+
+      // The sequence number is odd while the event is being written, so
+      // that readers can skip events which are being overwritten.
+      e.sequence.store(index * 2 + 1, std::memory_order_relaxed);
+      e.name.store(name, std::memory_order_release);
+      e.start.store(start, std::memory_order_release);
+      e.duration.store(end - start, std::memory_order_release);
+      e.thread.store(get_thread_id(), std::memory_order_release);
+      e.argument.store(argument, std::memory_order_release);
+      e.sequence.store(index * 2 + 2, std::memory_order_release);
+    }
+
+    /**
+     * Appends the recorded events to given string in Chrome trace event
+     * format, which can be opened in Perfetto or chrome://tracing.
+     */
+    void append_json(std::pmr::string& output) const
+    {
+      const auto next = m_next.load(std::memory_order_acquire);
+      const auto pid = static_cast<long>(::getpid());
+      char buffer[256];
+      bool first = true;
+
+      output.append("{\"traceEvents\":[");
+      for (auto index = next > m_capacity ? next - m_capacity : 0;
+           index < next;
+           ++index)
+      {
+        const auto& e = m_events[index % m_capacity];
+        const auto sequence = e.sequence.load(std::memory_order_acquire);
+        const auto name = e.name.load(std::memory_order_acquire);
+        const auto start = e.start.load(std::memory_order_acquire);
+        const auto duration = e.duration.load(std::memory_order_acquire);
+        const auto thread = e.thread.load(std::memory_order_acquire);
+        const auto argument = e.argument.load(std::memory_order_acquire);
+        int length;
+
+        // Keeps the loads above from being reordered after the sequence
+        // number is checked again.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence != index * 2 + 2
+            || e.sequence.load(std::memory_order_relaxed) != sequence)
+        {
+          continue;
+        }
+        length = std::snprintf(
+          buffer,
+          sizeof(buffer),
+          "%s{\"name\":\"%s\",\"cat\":\"peelo\",\"ph\":\"X\","
+          "\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"pid\":%ld,\"tid\":%lu",
+          first ? "" : ",\n",
+          name,
+          static_cast<unsigned long long>(start / 1000),
+          static_cast<unsigned>(start % 1000),
+          static_cast<unsigned long long>(duration / 1000),
+          static_cast<unsigned>(duration % 1000),
+          pid,
+          static_cast<unsigned long>(thread)
+        );
+        output.append(buffer, length);
+        if (argument >= 0)
+        {
+          length = std::snprintf(
+            buffer,
+            sizeof(buffer),
+            ",\"args\":{\"value\":%lld}",
+            static_cast<long long>(argument)
+          );
+          output.append(buffer, length);
+        }
+        output.append(1, '}');
+        first = false;
+      }
+      output.append("],\"displayTimeUnit\":\"ns\"}\n");
+    }
+
+  private:
+    struct event
+    {
+      std::atomic<std::uint64_t> sequence{0};
+      std::atomic<const char*> name{nullptr};
+      std::atomic<std::uint64_t> start{0};
+      std::atomic<std::uint64_t> duration{0};
+      std::atomic<std::uint64_t> thread{0};
+      std::atomic<std::int64_t> argument{-1};
+    };
+
+    /**
+     * Returns identifier of the calling thread, as shown in the trace.
+     */
+    static std::uint64_t get_thread_id()
+    {
+#if defined(SYS_gettid)
+      thread_local const auto id = static_cast<std::uint64_t>(
+        ::syscall(SYS_gettid)
+      );
+#else
+      thread_local const auto id = static_cast<std::uint64_t>(
+        std::hash<std::thread::id>()(std::this_thread::get_id())
+      );
+#endif
+
+      return id;
+    }
+
+  private:
+    const std::size_t m_capacity;
+    const std::unique_ptr<event[]> m_events;
+    std::atomic<std::uint64_t> m_next;
+  };
+
+  /**
+   * Records event for the lifetime of the object, if tracing is enabled.
+   */
+  class prompt::impl::trace_scope
+  {
+  public:
+    explicit trace_scope(trace_buffer* buffer,
+                         const char* name,
+                         std::int64_t argument = -1)
+      : m_buffer(buffer)
+      , m_name(name)
+      , m_argument(argument)
+      , m_start(buffer ? trace_buffer::now() : 0) {}
+
+    ~trace_scope()
+    {
+      if (m_buffer)
+      {
+        m_buffer->record(m_name, m_start, m_argument);
+      }
+    }
+
+    trace_scope(const trace_scope&) = delete;
+    trace_scope(trace_scope&&) = delete;
+    void operator=(const trace_scope&) = delete;
+    void operator=(trace_scope&&) = delete;
+
+  private:
+    trace_buffer* const m_buffer;
+    const char* const m_name;
+    const std::int64_t m_argument;
+    const std::uint64_t m_start;
+  };
+
+  /**
+   * Writes input of the user, the terminal size and the prompt of each
+   * line, and changes of the terminal size into a file with the time
+   * elapsed since the previous event. Events are made of variable length
+   * numbers: microseconds since the previous event followed by a tag, of
+   * which the lowest two bits tell the type of the event.
+   */
+  class prompt::impl::recorder
+  {
+  public:
+    recorder(std::FILE* file, std::pmr::memory_resource* resource)
+      : m_file(file)
+      , m_last(std::chrono::steady_clock::now())
+      , m_buffer(resource)
+    {
+      std::fwrite(recording_magic, 1, recording_magic_length, m_file);
+    }
+
+    ~recorder()
+    {
+      std::fclose(m_file);
+    }
+
+    recorder(const recorder&) = delete;
+    recorder(recorder&&) = delete;
+    void operator=(const recorder&) = delete;
+    void operator=(recorder&&) = delete;
+
+    /**
+     * Records input received from the terminal at given time. The tag is
+     * followed by the input itself.
+     */
+    void input(const char* data,
+               std::size_t length,
+               std::chrono::steady_clock::time_point time)
+    {
+      if (length > 0)
+      {
+        begin_event(
+          (static_cast<std::uint64_t>(length) << 2) | recording_input,
+          time
+        );
+        m_buffer.append(data, length);
+        write();
+      }
+    }
+
+    /**
+     * Records beginning of a new line. The tag is followed by the terminal
+     * size and the prompt.
+     */
+    void line(std::size_t cols, std::size_t rows, const std::string& prompt)
+    {
+      begin_event(recording_line);
+      append_number(cols);
+      append_number(rows);
+      append_number(prompt.length());
+      m_buffer.append(prompt);
+      write();
+      std::fflush(m_file);
+    }
+
+    /**
+     * Records change of the terminal size. The tag is followed by the new
+     * terminal size.
+     */
+    void resize(std::size_t cols, std::size_t rows)
+    {
+      begin_event(recording_resize);
+      append_number(cols);
+      append_number(rows);
+      write();
+    }
+
+  private:
+    void begin_event(std::uint64_t tag,
+                     std::chrono::steady_clock::time_point time =
+                       std::chrono::steady_clock::now())
+    {
+      m_buffer.clear();
+      append_number(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+          std::max(time, m_last) - m_last
+        ).count()
+      );
+      append_number(tag);
+      m_last = std::max(time, m_last);
+    }
+
+    void append_number(std::uint64_t value)
+    {
+      while (value >= 0x80)
+      {
+        m_buffer.append(1, static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+      }
+      m_buffer.append(1, static_cast<char>(value));
+    }
+
+    void write()
+    {
+      std::fwrite(m_buffer.data(), 1, m_buffer.length(), m_file);
+    }
+
+  private:
+    std::FILE* const m_file;
+    std::chrono::steady_clock::time_point m_last;
+    std::pmr::string m_buffer;
+  };
+
+  PEELO_PROMPT_INLINE
+  prompt::input_context::input_context(std::string_view buffer,
+                                       std::size_t cursor,
+                                       const std::pmr::vector<token>& tokens,
+                                       const std::atomic<bool>* canceled)
+    : m_buffer(buffer)
+    , m_cursor(cursor)
+    , m_tokens(tokens)
+    , m_canceled(canceled) {}
+
+  PEELO_PROMPT_INLINE
+  std::optional<std::size_t> prompt::input_context::current_token() const
+  {
+    const auto it = std::upper_bound(
+      std::begin(m_tokens),
+      std::end(m_tokens),
+      m_cursor,
+      [](std::size_t cursor, const token& t)
+      {
+        return cursor < t.offset;
+      }
+    );
+
+    if (it != std::begin(m_tokens)
+        && m_cursor <= (it - 1)->offset + (it - 1)->length)
+    {
+      return it - std::begin(m_tokens) - 1;
+    }
+
+    return std::optional<std::size_t>();
+  }
+
+  PEELO_PROMPT_INLINE
+  std::string prompt::input_context::unquote(const token& t) const
+  {
+    std::string result;
+    char quote = 0;
+
+    result.reserve(t.length);
+    for (auto i = t.offset; i < t.offset + t.length; ++i)
+    {
+      const auto c = m_buffer[i];
+
+      if (c == '\\' && quote != '\'' && i + 1 < t.offset + t.length)
+      {
+        result.append(1, m_buffer[++i]);
+      }
+      else if (quote ? c == quote : c == '"' || c == '\'')
+      {
+        quote = quote ? 0 : c;
+      } else {
+        result.append(1, c);
+      }
+    }
+
+    return result;
+  }
+
+  struct prompt::path_completion::cache
+  {
+    struct entry
+    {
+      /** Name of the file. */
+      std::string name;
+      /** Whether the file is a directory. */
+      bool directory;
+    };
+
+    struct listing
+    {
+      /** Device of the directory. */
+      ::dev_t dev;
+      /** Inode of the directory. */
+      ::ino_t ino;
+      /** Modification time of the directory when it was listed. */
+      ::timespec mtime;
+      /** Size of the directory when it was listed. */
+      ::off_t size;
+      /** Files in the directory, sorted by name. */
+      std::vector<entry> entries;
+    };
+
+    /**
+     * Returns modification time of a file, which is named differently on
+     * macOS.
+     */
+    static const ::timespec& get_mtime(const struct ::stat& st);
+
+    /**
+     * Returns listing of the given directory, either from the cache, or by
+     * reading the directory if it has not been listed before or if it has
+     * been modified since. Returns null if the directory cannot be read.
+     * Directories modified right before they were read are not cached, as
+     * further changes within the resolution of the timestamps would go
+     * unnoticed.
+     */
+    std::shared_ptr<const listing> get_listing(const std::string& path);
+
+    /**
+     * Reads names of the files in the given directory. On Linux the
+     * directory is read with getdents64() system call in large batches,
+     * elsewhere readdir() is used.
+     */
+    static bool read_directory(const std::string& path,
+                               std::vector<entry>& entries);
+
+    /**
+     * Adds a file found from a directory to its listing. The file is
+     * looked up only when the directory itself does not tell whether the
+     * file is a directory, which is the case with some file systems and
+     * with symbolic links.
+     */
+    static void add_entry(int fd,
+                          const char* name,
+                          unsigned char type,
+                          std::vector<entry>& entries);
+
+    /**
+     * Appends given text to a string, escaping characters that would
+     * otherwise split it into multiple words.
+     */
+    static void append_escaped(std::string& output, const std::string& text);
+
+    struct item
+    {
+      std::shared_ptr<const listing> contents;
+      /** Position of the directory in the order of use. */
+      std::list<std::string>::iterator use;
+    };
+
+    std::mutex mutex;
+    /** Paths of the listed directories, the most recently used first. */
+    std::list<std::string> uses;
+    std::unordered_map<std::string, item> listings;
+  };
+
+  PEELO_PROMPT_INLINE
+  prompt::path_completion::path_completion()
+    : m_cache(std::make_shared<cache>()) {}
+
+  PEELO_PROMPT_INLINE
+  void prompt::path_completion::operator()(
+    const input_context& context,
+    completion_container_type& completions
+  ) const
+  {
+    const auto index = context.current_token();
+    const auto buffer = context.buffer();
+    auto begin = context.cursor();
+    auto end = begin;
+    std::string word;
+
+    if (index)
+    {
+      const auto& token = context.tokens()[*index];
+
+      begin = token.offset;
+      end = token.offset + token.length;
+      word = context.unquote(token);
+    }
+
+    const auto slash = word.rfind('/');
+    const auto directory = slash == std::string::npos
+      ? std::string()
+      : word.substr(0, slash + 1);
+    const auto prefix = word.substr(directory.length());
+    const auto listing = m_cache->get_listing(
+      directory.empty() ? std::string(".") : directory
+    );
+
+    if (!listing)
+    {
+      return;
+    }
+
+    // Entries are sorted by name, so the ones beginning with the prefix
+    // are next to each other.
+    for (auto it = std::lower_bound(
+           std::begin(listing->entries),
+           std::end(listing->entries),
+           prefix,
+           [](const cache::entry& e, const std::string& name)
+           {
+             return e.name < name;
+           }
+         );
+         it != std::end(listing->entries)
+           && !it->name.compare(0, prefix.length(), prefix);
+         ++it)
+    {
+      std::string completion(buffer.substr(0, begin));
+
+      // Hidden files are completed only when asked for.
+      if (it->name[0] == '.' && prefix.empty())
+      {
+        continue;
+      }
+      cache::append_escaped(completion, directory);
+      cache::append_escaped(completion, it->name);
+      if (it->directory)
+      {
+        completion.append(1, '/');
+      }
+      completion.append(buffer.substr(end));
+      completions.emplace_back(completion);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  std::shared_ptr<const prompt::path_completion::cache::listing>
+  prompt::path_completion::cache::get_listing(const std::string& path)
+  {
+    // Coarsest resolution of file system timestamps, in seconds.
+    static const std::time_t timestamp_resolution = 2;
+    struct ::stat st;
+    std::shared_ptr<listing> result;
+    const auto now = std::time(nullptr);
+
+    if (::stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+      return nullptr;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      const auto it = listings.find(path);
+
+      if (it != std::end(listings))
+      {
+        const auto& contents = *it->second.contents;
+
+        if (contents.dev == st.st_dev
+            && contents.ino == st.st_ino
+            && contents.size == st.st_size
+            && contents.mtime.tv_sec == get_mtime(st).tv_sec
+            && contents.mtime.tv_nsec == get_mtime(st).tv_nsec)
+        {
+          uses.splice(
+            std::begin(uses),
+            uses,
+            it->second.use
+          );
+
+          return it->second.contents;
+        }
+      }
+    }
+
+    result = std::make_shared<listing>();
+    result->dev = st.st_dev;
+    result->ino = st.st_ino;
+    result->mtime = get_mtime(st);
+    result->size = st.st_size;
+    if (!read_directory(path, result->entries))
+    {
+      return nullptr;
+    }
+    std::sort(
+      std::begin(result->entries),
+      std::end(result->entries),
+      [](const entry& a, const entry& b)
+      {
+        return a.name < b.name;
+      }
+    );
+
+    if (result->mtime.tv_sec + timestamp_resolution >= now)
+    {
+      return result;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto it = listings.find(path);
+
+    if (it != std::end(listings))
+    {
+      it->second.contents = result;
+      uses.splice(
+        std::begin(uses),
+        uses,
+        it->second.use
+      );
+
+      return result;
+    }
+    if (listings.size() >= PEELO_PROMPT_PATH_CACHE_SIZE)
+    {
+      listings.erase(uses.back());
+      uses.pop_back();
+    }
+    uses.push_front(path);
+    listings[path] = { result, std::begin(uses) };
+
+    return result;
+  }
+
+  PEELO_PROMPT_INLINE
+  const ::timespec& prompt::path_completion::cache::get_mtime(
+    const struct ::stat& st
+  )
+  {
+#if defined(__APPLE__)
+    return st.st_mtimespec;
+#else
+    return st.st_mtim;
+#endif
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::path_completion::cache::read_directory(
+    const std::string& path,
+    std::vector<entry>& entries
+  )
+  {
+#if defined(__linux__) && defined(SYS_getdents64)
+    // Offsets of the fields in struct linux_dirent64.
+    static const std::size_t reclen_offset = 16;
+    static const std::size_t type_offset = 18;
+    static const std::size_t name_offset = 19;
+    const auto fd = ::open(
+      path.c_str(),
+      O_RDONLY | O_DIRECTORY | O_CLOEXEC
+    );
+    std::vector<char> buffer(64 * 1024);
+
+    if (fd < 0)
+    {
+      return false;
+    }
+    for (;;)
+    {
+      const auto count = ::syscall(
+        SYS_getdents64,
+        fd,
+        buffer.data(),
+        buffer.size()
+      );
+
+      if (count < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        ::close(fd);
+
+        return false;
+      }
+      else if (count == 0)
+      {
+        break;
+      }
+      for (long offset = 0; offset < count;)
+      {
+        const auto record = buffer.data() + offset;
+        unsigned short reclen;
+
+        std::memcpy(&reclen, record + reclen_offset, sizeof(reclen));
+        add_entry(
+          fd,
+          record + name_offset,
+          static_cast<unsigned char>(record[type_offset]),
+          entries
+        );
+        offset += reclen;
+      }
+    }
+    ::close(fd);
+#else
+    const auto dir = ::opendir(path.c_str());
+
+    if (!dir)
+    {
+      return false;
+    }
+    while (const auto ent = ::readdir(dir))
+    {
+      add_entry(::dirfd(dir), ent->d_name, ent->d_type, entries);
+    }
+    ::closedir(dir);
+#endif
+
+    return true;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::path_completion::cache::add_entry(int fd,
+                                                 const char* name,
+                                                 unsigned char type,
+                                                 std::vector<entry>& entries)
+  {
+    struct ::stat st;
+
+    if (!std::strcmp(name, ".") || !std::strcmp(name, ".."))
+    {
+      return;
+    }
+    if (type == DT_UNKNOWN || type == DT_LNK)
+    {
+      entries.push_back({
+        name,
+        !::fstatat(fd, name, &st, 0) && S_ISDIR(st.st_mode)
+      });
+    } else {
+      entries.push_back({ name, type == DT_DIR });
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::path_completion::cache::append_escaped(std::string& output,
+                                                      const std::string& text)
+  {
+    for (const auto c : text)
+    {
+      if (std::isspace(static_cast<unsigned char>(c))
+          || c == '"'
+          || c == '\''
+          || c == '\\')
+      {
+        output.append(1, '\\');
+      }
+      output.append(1, c);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  prompt::impl::prompt_layout::prompt_layout(
+    std::pmr::memory_resource* resource
+  )
+    : width(0)
+    , escapes(resource)
+    , breaks(resource) {}
+
+  PEELO_PROMPT_INLINE
+  prompt::impl::screen_contents::screen_contents(
+    std::pmr::memory_resource* resource
+  )
+    : valid(false)
+    , top(0)
+    , rows(resource)
+    , hint(resource)
+    , hint_width(0) {}
+
+  PEELO_PROMPT_INLINE
+  prompt::impl::state::state(std::pmr::memory_resource* resource)
+    : prompt(resource)
+    , layout(resource)
+    , lines(resource)
+    , checkpoints(resource)
+    , tokens(resource)
+    , hint(resource)
+    , screen(resource)
+    , completions(resource) {}
+
+  PEELO_PROMPT_INLINE
+  prompt::impl::frame::frame(std::pmr::memory_resource* resource)
+    : m_segments(resource)
+    , m_scratch(resource)
+    , m_iovecs(resource) {}
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::frame::clear()
+  {
+    m_segments.clear();
+    m_scratch.clear();
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::frame::append(const char* data, std::size_t length)
+  {
+    add_scratch_segment(length);
+    m_scratch.append(data, length);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::frame::append(std::size_t count, char c)
+  {
+    add_scratch_segment(count);
+    m_scratch.append(count, c);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::frame::append(std::string_view data)
+  {
+    append(data.data(), data.length());
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::frame::reference(const char* data, std::size_t length)
+  {
+    if (length > 0)
+    {
+      m_segments.push_back({ data, 0, length });
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::frame::append_to(std::string& output) const
+  {
+    for (const auto& segment : m_segments)
+    {
+      output.append(
+        segment.data ? segment.data : m_scratch.c_str() + segment.offset,
+        segment.length
+      );
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::frame::write(int fd)
+  {
+    std::size_t index = 0;
+
+    m_iovecs.clear();
+    for (const auto& segment : m_segments)
+    {
+      const auto data = segment.data
+        ? segment.data
+        : m_scratch.c_str() + segment.offset;
+
+      m_iovecs.push_back({ const_cast<char*>(data), segment.length });
+    }
+
+    while (index < m_iovecs.size())
+    {
+      const auto count = std::min<std::size_t>(
+        m_iovecs.size() - index,
+        IOV_MAX
+      );
+      auto written = ::writev(fd, m_iovecs.data() + index, count);
+
+      if (written < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+
+        return false;
+      }
+
+      // Skip the buffers which were completely written and continue from
+      // where the partial write left off.
+      while (index < m_iovecs.size() &&
+             static_cast<std::size_t>(written) >= m_iovecs[index].iov_len)
+      {
+        written -= m_iovecs[index++].iov_len;
+      }
+      if (written > 0)
+      {
+        m_iovecs[index].iov_base =
+          static_cast<char*>(m_iovecs[index].iov_base) + written;
+        m_iovecs[index].iov_len -= written;
+      }
+    }
+
+    return true;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::frame::add_scratch_segment(std::size_t length)
+  {
+    if (!m_segments.empty()
+        && !m_segments.back().data
+        && m_segments.back().offset + m_segments.back().length
+          == m_scratch.length())
+    {
+      m_segments.back().length += length;
+    } else {
+      m_segments.push_back({ nullptr, m_scratch.length(), length });
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  prompt::impl::impl(std::pmr::memory_resource* resource)
+    : m_resource(resource)
+    , m_multi_line(false)
+    , m_completion_menu(false)
+    , m_read_ahead(false)
+    , m_line(resource)
+    , m_raw_mode(false)
+    , m_terminal_probed(false)
+    , m_capabilities()
+    , m_pending_input(resource)
+    , m_awaiting_reports(false)
+    , m_report_input(resource)
+    , m_frame(resource)
+    , m_visible_rows(resource)
+    , m_menu(resource)
+    , m_buffer_version(0)
+    , m_speculation_limit(0)
+    , m_speculations(resource)
+    , m_canceled_speculations(resource)
+    , m_session_active(false)
+    , m_trace_path(resource)
+    , m_history_max_size(PEELO_PROMPT_DEFAULT_HISTORY_MAX_LEN)
+    , m_history_container(resource) {}
+
+  PEELO_PROMPT_INLINE
+  prompt::impl::~impl()
+  {
+    // Speculative completions still being computed are canceled, and waited
+    // for so that the callback never outlives the prompt.
+    for (const auto& s : m_speculations)
+    {
+      s.result->canceled = true;
+    }
+    for (const auto& s : m_speculations)
+    {
+      s.result->thread.join();
+    }
+    for (const auto& result : m_canceled_speculations)
+    {
+      result->thread.join();
+    }
+    disable_raw_mode(STDIN_FILENO);
+    if (!m_trace_path.empty())
+    {
+      write_trace(m_trace_path.c_str());
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  prompt::value_type prompt::impl::input(const std::string& prompt)
+  {
+    std::string buffer;
+    std::string_view line;
+
+    if (!read_line(prompt, buffer, line))
+    {
+      return value_type();
+    }
+    else if (line.data() == buffer.data())
+    {
+      return value_type(std::move(buffer));
+    }
+
+    return value_type(line);
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::input_into(const std::string& prompt, std::string& output)
+  {
+    std::string_view line;
+
+    if (!read_line(prompt, output, line))
+    {
+      return false;
+    }
+    else if (line.data() != output.data())
+    {
+      output.assign(line.data(), line.length());
+    }
+
+    return true;
+  }
+
+  PEELO_PROMPT_INLINE
+  std::optional<std::string_view>
+  prompt::impl::input_view(const std::string& prompt)
+  {
+    std::string_view line;
+
+    if (!read_line(prompt, m_line, line))
+    {
+      return std::optional<std::string_view>();
+    }
+
+    return std::optional<std::string_view>(line);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::clear_screen()
+  {
+    [[maybe_unused]] const auto written = ::write(
+      STDOUT_FILENO,
+      "\033[H\033[2J",
+      7
+    );
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::begin_session(const std::string& prompt,
+                                   std::size_t cols,
+                                   std::size_t rows,
+                                   std::string& output)
+  {
+    if (!m_session)
+    {
+      m_session = std::make_unique<struct state>(m_resource);
+    }
+    begin_state(*m_session, -1, -1, prompt, cols ? cols : 80, rows);
+    if (m_recorder)
+    {
+      m_recorder->line(m_session->cols, rows, prompt);
+    }
+    m_session->output = &output;
+    write_output(*m_session, prompt.c_str(), prompt.length());
+    m_session->output = nullptr;
+    m_session_active = true;
+  }
+
+  PEELO_PROMPT_INLINE
+  prompt::feed_status prompt::impl::feed(const char* data,
+                                         std::size_t length,
+                                         std::string& output,
+                                         std::size_t& consumed,
+                                         std::string& line)
+  {
+    const auto received = m_recorder
+      ? std::chrono::steady_clock::now()
+      : std::chrono::steady_clock::time_point();
+
+    consumed = 0;
+    if (!m_session_active)
+    {
+      return feed_status::pending;
+    }
+    m_session->output = &output;
+    while (consumed < length)
+    {
+      if (const auto result = process(*m_session, data[consumed++]))
+      {
+        if (m_recorder)
+        {
+          m_recorder->input(data, consumed, received);
+        }
+        output.append("\r\n", 2);
+        m_session->output = nullptr;
+        m_session_active = false;
+        if (!*result)
+        {
+          return feed_status::end_of_input;
+        }
+        line.assign(m_session->buf, m_session->len);
+
+        return feed_status::line;
+      }
+    }
+
+    // Escape key on its own closes the completion menu. Escape sequences
+    // are assumed to arrive in one piece.
+    if (m_session->menu_active
+        && m_session->escape
+        && m_session->seq_len == 0)
+    {
+      close_menu(*m_session);
+    }
+    speculate(*m_session);
+    m_session->output = nullptr;
+    if (m_recorder)
+    {
+      m_recorder->input(data, consumed, received);
+    }
+
+    return feed_status::pending;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::resize_session(std::size_t cols,
+                                    std::size_t rows,
+                                    std::string& output)
+  {
+    if (!m_session_active)
+    {
+      return;
+    }
+
+    auto& state = *m_session;
+
+    state.cols = cols ? cols : 80;
+    state.rows = rows;
+    if (m_recorder)
+    {
+      m_recorder->resize(state.cols, rows);
+    }
+    compute_prompt_layout(state.prompt, state.cols, state.layout);
+    state.lines.assign(1, { 0, state.layout.width / state.cols + 1 });
+    update_lines(state, 0, 0, state.len);
+    state.menu_active = false;
+    state.menu_rows = 0;
+    state.cycling = false;
+    state.completions.clear();
+    state.screen.valid = false;
+    state.output = &output;
+    refresh(state);
+    state.output = nullptr;
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::add_to_history(const std::string& line)
+  {
+    if (m_history_max_size == 0)
+    {
+      return false;
+    }
+
+    // Don't add duplicated lines.
+    if (!m_history_container.empty() &&
+        !m_history_container.back().compare(line))
+    {
+      return false;
+    }
+
+    if (m_history_container.size() == m_history_max_size)
+    {
+      m_history_container.pop_front();
+    }
+
+    m_history_container.emplace_back(line);
+
+    return true;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::set_history_max_size(std::size_t size)
+  {
+    if (size == 0)
+    {
+      m_history_container.clear();
+    } else {
+      while (m_history_container.size() > size)
+      {
+        m_history_container.pop_front();
+      }
+    }
+    m_history_max_size = size;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::set_completion_callback(
+    const std::optional<completion_callback_type>& callback
+  )
+  {
+    if (callback)
+    {
+      m_completion_callback = [callback = *callback](
+        const input_context& context,
+        completion_container_type& completions
+      )
+      {
+        callback(std::string(context.buffer()), completions);
+      };
+    } else {
+      m_completion_callback.reset();
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::set_completion_callback(
+    const vector_completion_callback_type& callback
+  )
+  {
+    if (callback)
+    {
+      m_completion_callback = [callback](
+        const input_context& context,
+        completion_container_type& completions
+      )
+      {
+        std::vector<std::string> result;
+
+        callback(std::string(context.buffer()), result);
+        completions.insert(
+          std::end(completions),
+          std::begin(result),
+          std::end(result)
+        );
+      };
+    } else {
+      m_completion_callback.reset();
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::set_hints_callback(
+    const std::optional<hints_callback_type>& callback
+  )
+  {
+    if (callback)
+    {
+      m_hints_callback = [callback = *callback](
+        const input_context& context,
+        color& col,
+        bool& bold
+      )
+      {
+        return callback(std::string(context.buffer()), col, bold);
+      };
+    } else {
+      m_hints_callback.reset();
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::start_recording(const std::string& path)
+  {
+    const auto file = std::fopen(path.c_str(), "wb");
+
+    if (!file)
+    {
+      return false;
+    }
+    m_recorder = std::make_unique<recorder>(file, m_resource);
+
+    return true;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::stop_recording()
+  {
+    m_recorder.reset();
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::set_tracing(std::size_t capacity, const std::string& path)
+  {
+    if (capacity > 0)
+    {
+      m_trace = std::make_shared<trace_buffer>(capacity);
+    } else {
+      m_trace.reset();
+    }
+    m_trace_path = path;
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::write_trace(const char* path) const
+  {
+    std::pmr::string output(m_resource);
+    std::FILE* file;
+    bool result;
+
+    if (!m_trace || !(file = std::fopen(path, "w")))
+    {
+      return false;
+    }
+    m_trace->append_json(output);
+    result = std::fwrite(output.data(), 1, output.length(), file)
+      == output.length();
+
+    return std::fclose(file) == 0 && result;
+  }
+
+  PEELO_PROMPT_INLINE
+  prompt::prompt(std::pmr::memory_resource* resource)
+    : m_impl(std::make_unique<impl>(resource)) {}
+
+  PEELO_PROMPT_INLINE
+  prompt::~prompt() = default;
+
+  PEELO_PROMPT_INLINE
+  prompt::value_type prompt::input(const std::string& prompt)
+  {
+    return m_impl->input(prompt);
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::input_into(const std::string& prompt, std::string& output)
+  {
+    return m_impl->input_into(prompt, output);
+  }
+
+  PEELO_PROMPT_INLINE
+  std::optional<std::string_view> prompt::input_view(const std::string& prompt)
+  {
+    return m_impl->input_view(prompt);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::clear_screen()
+  {
+    m_impl->clear_screen();
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::begin_session(const std::string& prompt,
+                             std::size_t cols,
+                             std::size_t rows,
+                             std::string& output)
+  {
+    m_impl->begin_session(prompt, cols, rows, output);
+  }
+
+  PEELO_PROMPT_INLINE
+  prompt::feed_status prompt::feed(const char* data,
+                                   std::size_t length,
+                                   std::string& output,
+                                   std::size_t& consumed,
+                                   std::string& line)
+  {
+    return m_impl->feed(data, length, output, consumed, line);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::resize_session(std::size_t cols,
+                              std::size_t rows,
+                              std::string& output)
+  {
+    m_impl->resize_session(cols, rows, output);
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::is_session_active() const
+  {
+    return m_impl->m_session_active;
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::is_multi_line() const
+  {
+    return m_impl->m_multi_line;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::set_multi_line(bool flag)
+  {
+    m_impl->m_multi_line = flag;
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::add_to_history(const std::string& line)
+  {
+    return m_impl->add_to_history(line);
+  }
+
+  PEELO_PROMPT_INLINE
+  std::size_t prompt::get_history_max_size() const
+  {
+    return m_impl->m_history_max_size;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::set_history_max_size(std::size_t size)
+  {
+    m_impl->set_history_max_size(size);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::set_completion_callback(
+    const std::optional<completion_callback_type>& callback
+  )
+  {
+    m_impl->set_completion_callback(callback);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::set_completion_callback(
+    const vector_completion_callback_type& callback
+  )
+  {
+    m_impl->set_completion_callback(callback);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::set_token_completion_callback(
+    const std::optional<token_completion_callback_type>& callback
+  )
+  {
+    m_impl->m_completion_callback = callback;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::set_hints_callback(
+    const std::optional<hints_callback_type>& callback
+  )
+  {
+    m_impl->set_hints_callback(callback);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::set_token_hints_callback(
+    const std::optional<token_hints_callback_type>& callback
+  )
+  {
+    m_impl->m_hints_callback = callback;
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::is_read_ahead() const
+  {
+    return m_impl->m_read_ahead;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::set_read_ahead(bool flag)
+  {
+    m_impl->m_read_ahead = flag;
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::is_completion_menu() const
+  {
+    return m_impl->m_completion_menu;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::set_completion_menu(bool flag)
+  {
+    m_impl->m_completion_menu = flag;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::set_completion_ranking(const std::optional<std::size_t>& limit)
+  {
+    m_impl->m_ranking_limit = limit;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::set_speculative_completion(
+    const std::optional<std::chrono::milliseconds>& delay,
+    std::size_t limit
+  )
+  {
+    m_impl->m_speculation_delay = delay;
+    m_impl->m_speculation_limit = limit;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::set_input_complete_callback(
+    const std::optional<input_complete_callback_type>& callback
+  )
+  {
+    m_impl->m_input_complete_callback = callback;
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::start_recording(const std::string& path)
+  {
+    return m_impl->start_recording(path);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::stop_recording()
+  {
+    m_impl->stop_recording();
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::set_tracing(std::size_t capacity, const std::string& path)
+  {
+    m_impl->set_tracing(capacity, path);
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::dump_trace(const std::string& path) const
+  {
+    return m_impl->write_trace(path.c_str());
+  }
+
+  PEELO_PROMPT_INLINE
+  const prompt::terminal_capabilities& prompt::get_terminal_capabilities() const
+  {
+    return m_impl->m_capabilities;
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::is_unsupported_term()
+  {
+    static const bool unsupported = impl::is_unsupported_term_name();
+
+    return unsupported;
+  }
+#if defined(__linux__)
+
+  struct prompt::driver::impl
+  {
+    /**
+     * State of a terminal being driven.
+     */
+    struct session
+    {
+      /** File descriptor of the terminal. */
+      int fd;
+      /** Prompt instance used for editing the lines. */
+      prompt* editor;
+      /** Prompt to display. */
+      std::string prompt_text;
+      /** Number of columns in terminal. */
+      std::size_t cols;
+      /** Number of rows in terminal. */
+      std::size_t rows;
+      /** Whether the terminal is still being prompted for lines. */
+      bool reading;
+      /** Whether the terminal has been removed from the driver. */
+      bool removed;
+      /** Output not yet given to the terminal. */
+      std::string output;
+    };
+
+    /**
+     * Sessions of the terminals indexed by their file descriptors, which
+     * are small integers.
+     */
+    template<class Session>
+    class session_table
+    {
+    public:
+      explicit session_table(std::pmr::memory_resource* resource)
+        : m_sessions(resource)
+        , m_size(0) {}
+
+      /**
+       * Returns number of sessions in the table.
+       */
+      inline std::size_t size() const
+      {
+        return m_size;
+      }
+
+      /**
+       * Returns session of the terminal, or null pointer if there is none.
+       */
+      inline Session* find(int fd) const
+      {
+        return fd >= 0 && static_cast<std::size_t>(fd) < m_sessions.size()
+          ? m_sessions[fd].get()
+          : nullptr;
+      }
+
+      /**
+       * Adds session for the terminal, which must not have one already.
+       */
+      inline Session& insert(int fd, std::unique_ptr<Session> s)
+      {
+        if (static_cast<std::size_t>(fd) >= m_sessions.size())
+        {
+          m_sessions.resize(fd + 1);
+        }
+        m_sessions[fd] = std::move(s);
+        ++m_size;
+
+        return *m_sessions[fd];
+      }
+
+      /**
+       * Removes session of the terminal from the table and returns it.
+       */
+      inline std::unique_ptr<Session> erase(int fd)
+      {
+        --m_size;
+
+        return std::move(m_sessions[fd]);
+      }
+
+    private:
+      std::pmr::vector<std::unique_ptr<Session>> m_sessions;
+      std::size_t m_size;
+    };
+
+    impl(const line_callback_type& callback,
+         std::pmr::memory_resource* resource);
+
+    /**
+     * Begins prompting for the first line on the terminal.
+     */
+    static void begin(session& s,
+                      int fd,
+                      prompt& editor,
+                      const std::string& prompt,
+                      std::size_t cols,
+                      std::size_t rows);
+
+    /**
+     * Feeds input read from the terminal to its session, beginning a new
+     * line each time the user is done with the previous one. Once the
+     * callback tells not to continue, rest of the input is ignored.
+     */
+    void receive(session& s, const char* data, std::size_t length);
+
+    /**
+     * Ends the session at end of input, or when the terminal can no longer
+     * be read or written to.
+     */
+    void end(session& s);
+
+    /** Memory resource used for the bookkeeping of the terminals. */
+    std::pmr::memory_resource* const m_resource;
+    const line_callback_type m_callback;
+  };
+
+  PEELO_PROMPT_INLINE
+  prompt::driver::impl::impl(const line_callback_type& callback,
+                             std::pmr::memory_resource* resource)
+    : m_resource(resource)
+    , m_callback(callback) {}
+
+  PEELO_PROMPT_INLINE
+  void prompt::driver::impl::begin(session& s,
+                                   int fd,
+                                   prompt& editor,
+                                   const std::string& prompt,
+                                   std::size_t cols,
+                                   std::size_t rows)
+  {
+    s.fd = fd;
+    s.editor = &editor;
+    s.prompt_text = prompt;
+    s.cols = cols;
+    s.rows = rows;
+    s.reading = true;
+    s.removed = false;
+    editor.begin_session(prompt, cols, rows, s.output);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::driver::impl::receive(session& s,
+                                     const char* data,
+                                     std::size_t length)
+  {
+    std::string line;
+
+    while (s.reading)
+    {
+      std::size_t consumed;
+      const auto status = s.editor->feed(
+        data,
+        length,
+        s.output,
+        consumed,
+        line
+      );
+
+      if (status == feed_status::pending)
+      {
+        break;
+      }
+      data += consumed;
+      length -= consumed;
+      if (!m_callback(
+        s.fd,
+        status == feed_status::line ? value_type(line) : value_type()
+      ))
+      {
+        s.reading = false;
+      }
+      else if (s.reading)
+      {
+        s.editor->begin_session(s.prompt_text, s.cols, s.rows, s.output);
+      }
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::driver::impl::end(session& s)
+  {
+    if (s.reading)
+    {
+      s.reading = false;
+      m_callback(s.fd, value_type());
+    }
+  }
+
+  struct prompt::epoll_driver::impl : public driver::impl
+  {
+    struct epoll_session : public session
+    {
+      /** Number of bytes of the output already written. */
+      std::size_t written;
+      /** Events the terminal is being waited for. */
+      std::uint32_t events;
+    };
+
+    impl(const line_callback_type& callback,
+         std::pmr::memory_resource* resource);
+
+    ~impl();
+
+    inline bool is_open() const
+    {
+      return m_fd != -1;
+    }
+
+    inline std::size_t size() const
+    {
+      return m_sessions.size();
+    }
+
+    bool add(int fd,
+             prompt& editor,
+             const std::string& prompt,
+             std::size_t cols,
+             std::size_t rows);
+
+    void remove(int fd);
+
+    void resize(int fd, std::size_t cols, std::size_t rows);
+
+    int run_once(int timeout);
+
+    void read_input(epoll_session& s);
+
+    /**
+     * Writes as much of the pending output to the terminal as it accepts,
+     * and waits for it to accept more if necessary. Once the terminal is no
+     * longer read and all output has been written, it's removed.
+     */
+    void flush(epoll_session& s);
+
+    int m_fd;
+    session_table<epoll_session> m_sessions;
+    std::pmr::vector<std::unique_ptr<epoll_session>> m_removed;
+  };
+
+  PEELO_PROMPT_INLINE
+  prompt::epoll_driver::epoll_driver(const line_callback_type& callback,
+                                     std::pmr::memory_resource* resource)
+    : m_impl(std::make_unique<impl>(callback, resource)) {}
+
+  PEELO_PROMPT_INLINE
+  prompt::epoll_driver::~epoll_driver() = default;
+
+  PEELO_PROMPT_INLINE
+  bool prompt::epoll_driver::is_open() const
+  {
+    return m_impl->is_open();
+  }
+
+  PEELO_PROMPT_INLINE
+  std::size_t prompt::epoll_driver::size() const
+  {
+    return m_impl->size();
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::epoll_driver::add(int fd,
+                                 prompt& editor,
+                                 const std::string& prompt,
+                                 std::size_t cols,
+                                 std::size_t rows)
+  {
+    return m_impl->add(fd, editor, prompt, cols, rows);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::epoll_driver::remove(int fd)
+  {
+    m_impl->remove(fd);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::epoll_driver::resize(int fd, std::size_t cols, std::size_t rows)
+  {
+    m_impl->resize(fd, cols, rows);
+  }
+
+  PEELO_PROMPT_INLINE
+  int prompt::epoll_driver::run_once(int timeout)
+  {
+    return m_impl->run_once(timeout);
+  }
+
+  PEELO_PROMPT_INLINE
+  prompt::epoll_driver::impl::impl(const line_callback_type& callback,
+                                   std::pmr::memory_resource* resource)
+    : driver::impl(callback, resource)
+    , m_fd(::epoll_create1(EPOLL_CLOEXEC))
+    , m_sessions(resource)
+    , m_removed(resource) {}
+
+  PEELO_PROMPT_INLINE
+  prompt::epoll_driver::impl::~impl()
+  {
+    if (m_fd != -1)
+    {
+      ::close(m_fd);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::epoll_driver::impl::add(int fd,
+                                       prompt& editor,
+                                       const std::string& prompt,
+                                       std::size_t cols,
+                                       std::size_t rows)
+  {
+    auto s = std::make_unique<epoll_session>();
+    ::epoll_event event;
+    int flags;
+
+    if (fd < 0)
+    {
+      errno = EBADF;
+      return false;
+    }
+    if (m_sessions.find(fd))
+    {
+      errno = EEXIST;
+      return false;
+    }
+    flags = ::fcntl(fd, F_GETFL);
+    if (flags == -1 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+      return false;
+    }
+    event.events = EPOLLIN;
+    event.data.ptr = s.get();
+    if (::epoll_ctl(m_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+      const auto error = errno;
+
+      ::fcntl(fd, F_SETFL, flags);
+      errno = error;
+
+      return false;
+    }
+    s->events = EPOLLIN;
+    s->written = 0;
+    begin(*s, fd, editor, prompt, cols, rows);
+    flush(m_sessions.insert(fd, std::move(s)));
+
+    return true;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::epoll_driver::impl::remove(int fd)
+  {
+    const auto s = m_sessions.find(fd);
+
+    if (!s)
+    {
+      return;
+    }
+    s->reading = false;
+    s->removed = true;
+    ::epoll_ctl(m_fd, EPOLL_CTL_DEL, fd, nullptr);
+    // Events of the terminal may still be waiting to be processed, so
+    // the session is kept around until they have been.
+    m_removed.push_back(m_sessions.erase(fd));
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::epoll_driver::impl::resize(int fd,
+                                          std::size_t cols,
+                                          std::size_t rows)
+  {
+    const auto s = m_sessions.find(fd);
+
+    if (s && s->reading)
+    {
+      s->cols = cols;
+      s->rows = rows;
+      s->editor->resize_session(cols, rows, s->output);
+      flush(*s);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  int prompt::epoll_driver::impl::run_once(int timeout)
+  {
+    ::epoll_event events[64];
+    const auto count = ::epoll_wait(m_fd, events, 64, timeout);
+
+    if (count == -1)
+    {
+      return errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < count; ++i)
+    {
+      auto& s = *static_cast<epoll_session*>(events[i].data.ptr);
+      const auto input = EPOLLIN | EPOLLHUP | EPOLLERR;
+
+      if (s.reading && (events[i].events & input))
+      {
+        read_input(s);
+      }
+      flush(s);
+    }
+    m_removed.clear();
+
+    return count;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::epoll_driver::impl::read_input(epoll_session& s)
+  {
+    char buffer[4096];
+    const auto length = ::read(s.fd, buffer, sizeof(buffer));
+
+    if (length > 0)
+    {
+      receive(s, buffer, length);
+    }
+    else if (length == 0 || (errno != EAGAIN && errno != EINTR))
+    {
+      end(s);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::epoll_driver::impl::flush(epoll_session& s)
+  {
+    std::uint32_t events;
+
+    if (s.removed)
+    {
+      return;
+    }
+    while (s.written < s.output.length())
+    {
+      const auto length = ::write(
+        s.fd,
+        s.output.data() + s.written,
+        s.output.length() - s.written
+      );
+
+      if (length == -1)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        else if (errno != EAGAIN)
+        {
+          end(s);
+          s.written = s.output.length();
+        }
+        break;
+      }
+      s.written += length;
+    }
+    if (s.removed)
+    {
+      return;
+    }
+    if (s.written == s.output.length())
+    {
+      s.output.clear();
+      s.written = 0;
+    }
+    events = (s.reading ? static_cast<std::uint32_t>(EPOLLIN) : 0)
+      | (s.output.empty() ? 0 : static_cast<std::uint32_t>(EPOLLOUT));
+    if (!events)
+    {
+      remove(s.fd);
+    }
+    else if (events != s.events)
+    {
+      ::epoll_event event;
+
+      event.events = events;
+      event.data.ptr = &s;
+      ::epoll_ctl(m_fd, EPOLL_CTL_MOD, s.fd, &event);
+      s.events = events;
+    }
+  }
+#if PEELO_PROMPT_IO_URING
+
+  struct prompt::io_uring_driver::impl : public driver::impl
+  {
+    /**
+     * Output of the terminal waiting to be written to it.
+     */
+    struct output_frame
+    {
+      /** Contents of the frame. */
+      std::string data;
+      /** Number of bytes already written. */
+      std::size_t written;
+    };
+
+    struct uring_session : public session
+    {
+      explicit uring_session(std::pmr::memory_resource* resource)
+        : frames(resource) {}
+
+      /** Whether a read is pending on the terminal. */
+      bool armed;
+      /** Whether the pending read is multishot. */
+      bool multishot;
+      /** Whether canceling operations of the terminal is waiting for room
+       * in the submission queue. */
+      bool canceling;
+      /** Whether the terminal has output ready for submission. */
+      bool queued;
+      /** Whether writing to the terminal has failed. */
+      bool failed;
+      /** Number of operations pending on the terminal. */
+      std::size_t operations;
+      /** Frames waiting to be written to the terminal. */
+      std::pmr::deque<output_frame> frames;
+      /** Number of frames submitted to the kernel. */
+      std::size_t submitted;
+      /** Number of submitted frames the kernel has completed. */
+      std::size_t completed;
+    };
+
+    /** Operation types encoded in the user data of submissions. */
+    static constexpr std::uint64_t operation_read = 1;
+    static constexpr std::uint64_t operation_write = 2;
+
+    // Multishot read, introduced in Linux 6.7, is missing from older
+    // kernel headers.
+    static constexpr std::uint8_t op_read_multishot = 49;
+
+    impl(const line_callback_type& callback,
+         std::pmr::memory_resource* resource);
+
+    ~impl();
+
+    inline bool is_open() const
+    {
+      return m_fd != -1;
+    }
+
+    inline std::size_t size() const
+    {
+      return m_sessions.size();
+    }
+
+    bool add(int fd,
+             prompt& editor,
+             const std::string& prompt,
+             std::size_t cols,
+             std::size_t rows);
+
+    void remove(int fd);
+
+    void resize(int fd, std::size_t cols, std::size_t rows);
+
+    int run_once(int timeout);
+
+    void open();
+
+    void close();
+
+    /**
+     * Submits the queued submissions and waits for given number of
+     * completions.
+     */
+    int enter(std::uint32_t wait,
+              std::uint32_t flags,
+              ::io_uring_getevents_arg* arg = nullptr);
+
+    /**
+     * Returns number of submission queue entries available. If the queue
+     * is full, the submissions are given to the kernel first.
+     */
+    std::uint32_t get_available_sqes();
+
+    /**
+     * Returns next cleared submission queue entry, or null pointer if the
+     * queue is full.
+     */
+    ::io_uring_sqe* get_sqe();
+
+    /**
+     * Gives buffer back to the kernel to read input into.
+     */
+    void recycle_buffer(std::uint16_t id);
+
+    /**
+     * Submits read from the terminal. With multishot reads, the read stays
+     * active until it fails or is canceled.
+     */
+    bool arm(uring_session& s);
+
+    void complete_read(uring_session& s, int result, std::uint32_t flags);
+
+    /**
+     * Cancels the pending read of the terminal, and its writes too if
+     * the terminal has been removed. If the submission queue is full, the
+     * cancellation is retried on the next call to run_once().
+     */
+    void cancel_read(uring_session& s);
+
+    /**
+     * Submits the cancellation. Returns false if the submission queue is
+     * full.
+     */
+    bool submit_cancel(uring_session& s);
+
+    void complete_write(uring_session& s, int result);
+
+    /**
+     * Turns output of the terminal into a frame, and queues the terminal
+     * for submitting its frames.
+     */
+    void queue_output(uring_session& s);
+
+    /**
+     * Submits frames waiting to be written to the terminal as a chain of
+     * linked writes, so that they are written in order.
+     */
+    void submit_output(uring_session& s);
+
+    int m_fd;
+    void* m_sq_ring;
+    std::size_t m_sq_ring_size;
+    void* m_cq_ring;
+    std::size_t m_cq_ring_size;
+    void* m_sqes;
+    std::size_t m_sqes_size;
+    std::uint32_t* m_sq_head;
+    std::uint32_t* m_sq_tail;
+    std::uint32_t* m_sq_array;
+    std::uint32_t m_sq_mask;
+    std::uint32_t m_sq_entries;
+    std::uint32_t m_sq_local_tail;
+    std::uint32_t* m_cq_head;
+    std::uint32_t* m_cq_tail;
+    std::uint32_t m_cq_mask;
+    ::io_uring_cqe* m_cqes;
+    void* m_buffer_ring;
+    std::size_t m_buffer_ring_size;
+    std::uint16_t m_buffer_tail;
+    std::unique_ptr<char[]> m_buffers;
+    bool m_multishot;
+    session_table<uring_session> m_sessions;
+    std::pmr::vector<std::unique_ptr<uring_session>> m_removed;
+    std::pmr::vector<uring_session*> m_ready;
+    std::pmr::vector<uring_session*> m_submitting;
+    std::pmr::vector<uring_session*> m_canceling;
+    std::pmr::vector<std::string> m_spare_frames;
+  };
+
+  PEELO_PROMPT_INLINE
+  prompt::io_uring_driver::impl::impl(const line_callback_type& callback,
+                                      std::pmr::memory_resource* resource)
+    : driver::impl(callback, resource)
+    , m_fd(-1)
+    , m_sq_ring(MAP_FAILED)
+    , m_cq_ring(MAP_FAILED)
+    , m_sqes(MAP_FAILED)
+    , m_buffer_ring(MAP_FAILED)
+    , m_buffer_tail(0)
+    , m_multishot(true)
+    , m_sessions(resource)
+    , m_removed(resource)
+    , m_ready(resource)
+    , m_submitting(resource)
+    , m_canceling(resource)
+    , m_spare_frames(resource)
+  {
+    open();
+  }
+
+  PEELO_PROMPT_INLINE
+  prompt::io_uring_driver::impl::~impl()
+  {
+    close();
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::io_uring_driver::impl::add(int fd,
+                                          prompt& editor,
+                                          const std::string& prompt,
+                                          std::size_t cols,
+                                          std::size_t rows)
+  {
+    auto s = std::make_unique<uring_session>(m_resource);
+
+    if (fd < 0)
+    {
+      errno = EBADF;
+      return false;
+    }
+    if (m_sessions.find(fd))
+    {
+      errno = EEXIST;
+      return false;
+    }
+    s->armed = false;
+    s->multishot = false;
+    s->canceling = false;
+    s->queued = false;
+    s->failed = false;
+    s->operations = 0;
+    s->submitted = 0;
+    s->completed = 0;
+    begin(*s, fd, editor, prompt, cols, rows);
+    if (!arm(*s))
+    {
+      errno = EBUSY;
+      return false;
+    }
+    queue_output(m_sessions.insert(fd, std::move(s)));
+
+    return true;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::io_uring_driver::impl::remove(int fd)
+  {
+    const auto s = m_sessions.find(fd);
+
+    if (!s)
+    {
+      return;
+    }
+    s->reading = false;
+    s->removed = true;
+    if (s->operations > 0)
+    {
+      if (auto sqe = get_sqe())
+      {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD
+          | IORING_ASYNC_CANCEL_ALL;
+      }
+      else if (!s->canceling)
+      {
+        // The file descriptor may be reused by then, so the retry cancels
+        // the operations by their user data instead.
+        s->canceling = true;
+        m_canceling.push_back(s);
+      }
+      // Submitted right away, as the file descriptor may be closed once
+      // we return.
+      enter(0, 0);
+    }
+    // Buffers of the session may still be in use by the kernel, so it's
+    // kept around until its operations have completed.
+    m_removed.push_back(m_sessions.erase(fd));
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::io_uring_driver::impl::resize(int fd,
+                                             std::size_t cols,
+                                             std::size_t rows)
+  {
+    const auto s = m_sessions.find(fd);
+
+    if (s && s->reading)
+    {
+      s->cols = cols;
+      s->rows = rows;
+      s->editor->resize_session(cols, rows, s->output);
+      queue_output(*s);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  int prompt::io_uring_driver::impl::run_once(int timeout)
+  {
+    ::__kernel_timespec ts;
+    ::io_uring_getevents_arg arg;
+    std::uint32_t head = *m_cq_head;
+    std::uint32_t tail;
+    int count = 0;
+
+    // Terminals whose frames did not fit into the submission queue are
+    // queued again.
+    m_submitting.swap(m_ready);
+    for (const auto s : m_submitting)
+    {
+      s->queued = false;
+      if (!s->removed)
+      {
+        submit_output(*s);
+        queue_output(*s);
+      }
+    }
+    m_submitting.clear();
+    // As are cancellations which did not fit into it.
+    m_canceling.erase(
+      std::remove_if(
+        std::begin(m_canceling),
+        std::end(m_canceling),
+        [this](uring_session* s)
+        {
+          if (s->operations == 0 || submit_cancel(*s))
+          {
+            s->canceling = false;
+          }
+
+          return !s->canceling;
+        }
+      ),
+      std::end(m_canceling)
+    );
+    m_removed.erase(
+      std::remove_if(
+        std::begin(m_removed),
+        std::end(m_removed),
+        [](const std::unique_ptr<uring_session>& s)
+        {
+          return s->operations == 0 && !s->queued && !s->canceling;
+        }
+      ),
+      std::end(m_removed)
+    );
+
+    std::memset(&arg, 0, sizeof(arg));
+    if (timeout >= 0)
+    {
+      ts.tv_sec = timeout / 1000;
+      ts.tv_nsec = (timeout % 1000) * 1000000L;
+      arg.ts = reinterpret_cast<std::uintptr_t>(&ts);
+    }
+    if (enter(timeout ? 1 : 0, IORING_ENTER_GETEVENTS, &arg) == -1
+        && errno != ETIME
+        && errno != EINTR)
+    {
+      return -1;
+    }
+
+    tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head, ++count)
+    {
+      const auto cqe = m_cqes[head & m_cq_mask];
+
+      // Release the entry before processing it, as callbacks may end up
+      // submitting more operations.
+      __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+      if (!cqe.user_data)
+      {
+        continue;
+      }
+
+      auto& s = *reinterpret_cast<uring_session*>(
+        cqe.user_data & ~static_cast<std::uint64_t>(3)
+      );
+
+      if (cqe.user_data & operation_read)
+      {
+        complete_read(s, cqe.res, cqe.flags);
+      } else {
+        complete_write(s, cqe.res);
+      }
+      if (!s.removed)
+      {
+        queue_output(s);
+        if (!s.reading && s.operations == 0 && s.frames.empty())
+        {
+          remove(s.fd);
+        }
+      }
+    }
+
+    return count;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::io_uring_driver::impl::open()
+  {
+    ::io_uring_params params;
+    ::io_uring_buf_reg reg;
+
+    std::memset(&params, 0, sizeof(params));
+    m_fd = static_cast<int>(::syscall(
+      __NR_io_uring_setup,
+      PEELO_PROMPT_IO_URING_ENTRIES,
+      &params
+    ));
+    if (m_fd == -1)
+    {
+      return;
+    }
+    if (!(params.features & IORING_FEAT_EXT_ARG))
+    {
+      close();
+      return;
+    }
+
+    m_sq_ring_size = params.sq_off.array
+      + params.sq_entries * sizeof(std::uint32_t);
+    m_cq_ring_size = params.cq_off.cqes
+      + params.cq_entries * sizeof(::io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      m_sq_ring_size = m_cq_ring_size = std::max(
+        m_sq_ring_size,
+        m_cq_ring_size
+      );
+    }
+    m_sq_ring = ::mmap(
+      nullptr,
+      m_sq_ring_size,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      m_fd,
+      IORING_OFF_SQ_RING
+    );
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      m_cq_ring = m_sq_ring;
+    } else {
+      m_cq_ring = ::mmap(
+        nullptr,
+        m_cq_ring_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        m_fd,
+        IORING_OFF_CQ_RING
+      );
+    }
+    m_sqes_size = params.sq_entries * sizeof(::io_uring_sqe);
+    m_sqes = ::mmap(
+      nullptr,
+      m_sqes_size,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      m_fd,
+      IORING_OFF_SQES
+    );
+    if (m_sq_ring == MAP_FAILED
+        || m_cq_ring == MAP_FAILED
+        || m_sqes == MAP_FAILED)
+    {
+      close();
+      return;
+    }
+
+    const auto sq = static_cast<char*>(m_sq_ring);
+    const auto cq = static_cast<char*>(m_cq_ring);
+
+    m_sq_head = reinterpret_cast<std::uint32_t*>(sq + params.sq_off.head);
+    m_sq_tail = reinterpret_cast<std::uint32_t*>(sq + params.sq_off.tail);
+    m_sq_array = reinterpret_cast<std::uint32_t*>(
+      sq + params.sq_off.array
+    );
+    m_sq_mask = *reinterpret_cast<std::uint32_t*>(
+      sq + params.sq_off.ring_mask
+    );
+    m_sq_entries = params.sq_entries;
+    m_sq_local_tail = *m_sq_tail;
+    m_cq_head = reinterpret_cast<std::uint32_t*>(cq + params.cq_off.head);
+    m_cq_tail = reinterpret_cast<std::uint32_t*>(cq + params.cq_off.tail);
+    m_cq_mask = *reinterpret_cast<std::uint32_t*>(
+      cq + params.cq_off.ring_mask
+    );
+    m_cqes = reinterpret_cast<::io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // Register the ring of buffers the kernel picks from when input
+    // arrives, instead of each read having a buffer of its own.
+    m_buffer_ring_size = PEELO_PROMPT_IO_URING_BUFFERS
+      * sizeof(::io_uring_buf);
+    m_buffer_ring = ::mmap(
+      nullptr,
+      m_buffer_ring_size,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS,
+      -1,
+      0
+    );
+    if (m_buffer_ring == MAP_FAILED)
+    {
+      close();
+      return;
+    }
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<std::uintptr_t>(m_buffer_ring);
+    reg.ring_entries = PEELO_PROMPT_IO_URING_BUFFERS;
+    reg.bgid = 0;
+    if (::syscall(
+      __NR_io_uring_register,
+      m_fd,
+      IORING_REGISTER_PBUF_RING,
+      &reg,
+      1
+    ) == -1)
+    {
+      close();
+      return;
+    }
+    m_buffers = std::make_unique<char[]>(
+      PEELO_PROMPT_IO_URING_BUFFERS * PEELO_PROMPT_IO_URING_BUFFER_SIZE
+    );
+    for (std::uint16_t i = 0; i < PEELO_PROMPT_IO_URING_BUFFERS; ++i)
+    {
+      recycle_buffer(i);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::io_uring_driver::impl::close()
+  {
+    if (m_buffer_ring != MAP_FAILED)
+    {
+      ::munmap(m_buffer_ring, m_buffer_ring_size);
+      m_buffer_ring = MAP_FAILED;
+    }
+    if (m_sqes != MAP_FAILED)
+    {
+      ::munmap(m_sqes, m_sqes_size);
+      m_sqes = MAP_FAILED;
+    }
+    if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+    {
+      ::munmap(m_cq_ring, m_cq_ring_size);
+    }
+    m_cq_ring = MAP_FAILED;
+    if (m_sq_ring != MAP_FAILED)
+    {
+      ::munmap(m_sq_ring, m_sq_ring_size);
+      m_sq_ring = MAP_FAILED;
+    }
+    if (m_fd != -1)
+    {
+      ::close(m_fd);
+      m_fd = -1;
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  int prompt::io_uring_driver::impl::enter(std::uint32_t wait,
+                                           std::uint32_t flags,
+                                           ::io_uring_getevents_arg* arg)
+  {
+    const auto pending = m_sq_local_tail
+      - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+
+    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+
+    return static_cast<int>(::syscall(
+      __NR_io_uring_enter,
+      m_fd,
+      pending,
+      wait,
+      flags | (arg ? IORING_ENTER_EXT_ARG : 0),
+      arg,
+      arg ? sizeof(*arg) : 0
+    ));
+  }
+
+  PEELO_PROMPT_INLINE
+  std::uint32_t prompt::io_uring_driver::impl::get_available_sqes()
+  {
+    auto available = m_sq_entries - (
+      m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE)
+    );
+
+    if (!available && enter(0, 0) != -1)
+    {
+      available = m_sq_entries - (
+        m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE)
+      );
+    }
+
+    return available;
+  }
+
+  PEELO_PROMPT_INLINE
+  ::io_uring_sqe* prompt::io_uring_driver::impl::get_sqe()
+  {
+    if (!get_available_sqes())
+    {
+      return nullptr;
+    }
+
+    const auto index = m_sq_local_tail++ & m_sq_mask;
+    auto sqe = static_cast<::io_uring_sqe*>(m_sqes) + index;
+
+    std::memset(sqe, 0, sizeof(*sqe));
+    m_sq_array[index] = index;
+
+    return sqe;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::io_uring_driver::impl::recycle_buffer(std::uint16_t id)
+  {
+    // The flexible array of io_uring_buf_ring has different offset in
+    // C++ than in C, so the ring is accessed as an array of buffers, with
+    // the tail overlaid on reserved field of the first one.
+    auto ring = static_cast<::io_uring_buf*>(m_buffer_ring);
+    const auto mask = PEELO_PROMPT_IO_URING_BUFFERS - 1;
+    auto& buffer = ring[m_buffer_tail & mask];
+
+    buffer.addr = reinterpret_cast<std::uintptr_t>(
+      m_buffers.get() + id * PEELO_PROMPT_IO_URING_BUFFER_SIZE
+    );
+    buffer.len = PEELO_PROMPT_IO_URING_BUFFER_SIZE;
+    buffer.bid = id;
+    __atomic_store_n(&ring[0].resv, ++m_buffer_tail, __ATOMIC_RELEASE);
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::io_uring_driver::impl::arm(uring_session& s)
+  {
+    auto sqe = get_sqe();
+
+    if (!sqe)
+    {
+      return false;
+    }
+    sqe->opcode = m_multishot
+      ? op_read_multishot
+      : static_cast<std::uint8_t>(IORING_OP_READ);
+    sqe->fd = s.fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->len = m_multishot ? 0 : PEELO_PROMPT_IO_URING_BUFFER_SIZE;
+    sqe->off = static_cast<std::uint64_t>(-1);
+    sqe->user_data = reinterpret_cast<std::uintptr_t>(&s)
+      | operation_read;
+    s.armed = true;
+    s.multishot = m_multishot;
+    ++s.operations;
+
+    return true;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::io_uring_driver::impl::complete_read(uring_session& s,
+                                                    int result,
+                                                    std::uint32_t flags)
+  {
+    if (!(flags & IORING_CQE_F_MORE))
+    {
+      s.armed = false;
+      --s.operations;
+    }
+    if (flags & IORING_CQE_F_BUFFER)
+    {
+      const auto id = static_cast<std::uint16_t>(
+        flags >> IORING_CQE_BUFFER_SHIFT
+      );
+
+      if (result > 0)
+      {
+        receive(
+          s,
+          m_buffers.get() + id * PEELO_PROMPT_IO_URING_BUFFER_SIZE,
+          result
+        );
+      }
+      recycle_buffer(id);
+    }
+    if (result == -EINVAL && s.multishot)
+    {
+      // Kernel does not support multishot reads, so fall back to
+      // submitting a new read after each one completes. Multishot reads
+      // of the other terminals fail the same way, and are resubmitted as
+      // single reads once they do.
+      m_multishot = false;
+    }
+    else if (result == 0
+             || (result < 0
+               && result != -ENOBUFS
+               && result != -EAGAIN
+               && result != -EINTR
+               && result != -ECANCELED))
+    {
+      end(s);
+    }
+    if (s.reading && !s.armed)
+    {
+      arm(s);
+    }
+    else if (!s.reading && s.armed)
+    {
+      cancel_read(s);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::io_uring_driver::impl::cancel_read(uring_session& s)
+  {
+    if (!s.canceling && !submit_cancel(s))
+    {
+      s.canceling = true;
+      m_canceling.push_back(&s);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::io_uring_driver::impl::submit_cancel(uring_session& s)
+  {
+    const auto count = s.removed ? 2 : 1;
+
+    if (get_available_sqes() < static_cast<std::uint32_t>(count))
+    {
+      return false;
+    }
+    for (int i = 0; i < count; ++i)
+    {
+      auto sqe = get_sqe();
+
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = reinterpret_cast<std::uintptr_t>(&s)
+        | (i ? operation_write : operation_read);
+      sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+    }
+
+    return true;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::io_uring_driver::impl::complete_write(uring_session& s,
+                                                     int result)
+  {
+    auto& frame = s.frames[s.completed++];
+
+    --s.operations;
+    if (result > 0)
+    {
+      frame.written += result;
+    }
+    else if (result != -ECANCELED
+             && result != -EAGAIN
+             && result != -EINTR)
+    {
+      s.failed = true;
+    }
+    if (s.completed < s.submitted)
+    {
+      return;
+    }
+
+    // A short write breaks the chain, and the writes after it are
+    // canceled, so the frames written completely are always first.
+    while (!s.frames.empty()
+           && s.frames.front().written == s.frames.front().data.length())
+    {
+      s.frames.front().data.clear();
+      m_spare_frames.push_back(std::move(s.frames.front().data));
+      s.frames.pop_front();
+    }
+    s.submitted = s.completed = 0;
+    if (s.failed)
+    {
+      s.frames.clear();
+      end(s);
+      if (s.armed)
+      {
+        cancel_read(s);
+      }
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::io_uring_driver::impl::queue_output(uring_session& s)
+  {
+    if (!s.output.empty())
+    {
+      output_frame frame;
+
+      if (!m_spare_frames.empty())
+      {
+        frame.data = std::move(m_spare_frames.back());
+        m_spare_frames.pop_back();
+      }
+      frame.data.swap(s.output);
+      frame.written = 0;
+      s.frames.push_back(std::move(frame));
+    }
+    if (!s.queued && !s.submitted && !s.frames.empty())
+    {
+      s.queued = true;
+      m_ready.push_back(&s);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::io_uring_driver::impl::submit_output(uring_session& s)
+  {
+    const auto count = std::min<std::size_t>(
+      s.frames.size(),
+      get_available_sqes()
+    );
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      const auto& frame = s.frames[i];
+      auto sqe = get_sqe();
+
+      sqe->opcode = IORING_OP_WRITE;
+      sqe->fd = s.fd;
+      sqe->flags = i + 1 < count ? IOSQE_IO_LINK : 0;
+      sqe->addr = reinterpret_cast<std::uintptr_t>(
+        frame.data.data() + frame.written
+      );
+      sqe->len = frame.data.length() - frame.written;
+      sqe->off = static_cast<std::uint64_t>(-1);
+      sqe->user_data = reinterpret_cast<std::uintptr_t>(&s)
+        | operation_write;
+      ++s.operations;
+    }
+    s.submitted = count;
+  }
+#else
+  /**
+   * Stand-in for the io_uring driver when the library was compiled without
+   * io_uring support, which fails to open.
+   */
+  struct prompt::io_uring_driver::impl : public driver::impl
+  {
+    impl(const line_callback_type& callback,
+         std::pmr::memory_resource* resource)
+      : driver::impl(callback, resource) {}
+
+    inline bool is_open() const
+    {
+      return false;
+    }
+
+    inline std::size_t size() const
+    {
+      return 0;
+    }
+
+    inline bool add(int, prompt&, const std::string&, std::size_t, std::size_t)
+    {
+      errno = ENOSYS;
+
+      return false;
+    }
+
+    inline void remove(int) {}
+
+    inline void resize(int, std::size_t, std::size_t) {}
+
+    inline int run_once(int)
+    {
+      errno = ENOSYS;
+
+      return -1;
+    }
+  };
+#endif
+
+  PEELO_PROMPT_INLINE
+  prompt::io_uring_driver::io_uring_driver(const line_callback_type& callback,
+                                           std::pmr::memory_resource* resource)
+    : m_impl(std::make_unique<impl>(callback, resource)) {}
+
+  PEELO_PROMPT_INLINE
+  prompt::io_uring_driver::~io_uring_driver() = default;
+
+  PEELO_PROMPT_INLINE
+  bool prompt::io_uring_driver::is_open() const
+  {
+    return m_impl->is_open();
+  }
+
+  PEELO_PROMPT_INLINE
+  std::size_t prompt::io_uring_driver::size() const
+  {
+    return m_impl->size();
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::io_uring_driver::add(int fd,
+                                    prompt& editor,
+                                    const std::string& prompt,
+                                    std::size_t cols,
+                                    std::size_t rows)
+  {
+    return m_impl->add(fd, editor, prompt, cols, rows);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::io_uring_driver::remove(int fd)
+  {
+    m_impl->remove(fd);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::io_uring_driver::resize(int fd,
+                                       std::size_t cols,
+                                       std::size_t rows)
+  {
+    m_impl->resize(fd, cols, rows);
+  }
+
+  PEELO_PROMPT_INLINE
+  int prompt::io_uring_driver::run_once(int timeout)
+  {
+    return m_impl->run_once(timeout);
+  }
+#endif
+
+  PEELO_PROMPT_INLINE
+  prompt::recording::recording(const std::string& path,
+                               std::pmr::memory_resource* resource)
+    : m_open(false)
+    , m_data(resource)
+  {
+    char buffer[4096];
+    std::size_t length;
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+
+    if (!file)
+    {
+      return;
+    }
+    while ((length = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+      m_data.append(buffer, length);
+    }
+    m_open = !std::ferror(file)
+      && !m_data.compare(0,
+                         impl::recording_magic_length,
+                         impl::recording_magic);
+    std::fclose(file);
+  }
+
+  PEELO_PROMPT_INLINE
+  std::size_t prompt::recording::replay(prompt& editor,
+                                        bool real_time,
+                                        const line_callback_type& callback,
+                                        std::string& output) const
+  {
+    const auto start = std::chrono::steady_clock::now();
+    // Time beyond which the events could not be scheduled without
+    // overflowing the clock.
+    const auto max_elapsed =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::time_point::max() - start
+      );
+    std::chrono::microseconds elapsed(0);
+    std::size_t offset = impl::recording_magic_length;
+    std::size_t count = 0;
+    std::uint64_t delay;
+    std::uint64_t tag;
+    std::string line;
+
+    while (read_number(offset, delay) && read_number(offset, tag))
+    {
+      if (delay > static_cast<std::uint64_t>((max_elapsed - elapsed).count()))
+      {
+        break;
+      }
+      elapsed += std::chrono::microseconds(delay);
+      if (real_time)
+      {
+        std::this_thread::sleep_until(start + elapsed);
+      }
+      if ((tag & 3) == impl::recording_input)
+      {
+        auto length = static_cast<std::size_t>(tag >> 2);
+        auto data = m_data.data() + offset;
+
+        if (length > m_data.length() - offset)
+        {
+          break;
+        }
+        offset += length;
+        while (length > 0)
+        {
+          std::size_t consumed;
+          const auto status = editor.feed(
+            data,
+            length,
+            output,
+            consumed,
+            line
+          );
+
+          if (status == feed_status::pending || !consumed)
+          {
+            break;
+          }
+          data += consumed;
+          length -= consumed;
+          ++count;
+          callback(
+            status == feed_status::line ? value_type(line) : value_type()
+          );
+        }
+      } else {
+        std::uint64_t cols;
+        std::uint64_t rows;
+        std::uint64_t length;
+
+        if (!read_number(offset, cols) || !read_number(offset, rows))
+        {
+          break;
+        }
+        if ((tag & 3) == impl::recording_resize)
+        {
+          editor.resize_session(cols, rows, output);
+        }
+        else if (!read_number(offset, length)
+                 || length > m_data.length() - offset)
+        {
+          break;
+        } else {
+          editor.begin_session(
+            std::string(std::string_view(m_data).substr(offset, length)),
+            cols,
+            rows,
+            output
+          );
+          offset += length;
+        }
+      }
+    }
+
+    return count;
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::recording::read_number(std::size_t& offset,
+                                      std::uint64_t& value) const
+  {
+    value = 0;
+    for (unsigned shift = 0; offset < m_data.length(); shift += 7)
+    {
+      const auto byte = static_cast<unsigned char>(m_data[offset++]);
+
+      // Reject corrupt numbers which do not fit into 64 bits.
+      if (shift > 63 || (shift == 63 && (byte & 0x7e)))
+      {
+        return false;
+      }
+      value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  PEELO_PROMPT_INLINE
+  prompt::impl::thread_pool& prompt::impl::get_thread_pool()
+  {
+    static thread_pool pool(
+      std::min(std::max(std::thread::hardware_concurrency(), 1u), 8u)
+    );
+
+    return pool;
+  }
+
+  PEELO_PROMPT_INLINE
+  prompt::impl::menu::menu(std::pmr::memory_resource* resource)
+    : height(0)
+    , bottom(0)
+    , strip(0)
+    , selected(0)
+    , page(0)
+    , pages(resource)
+    , columns(resource)
+    , end(0) {}
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::is_unsupported_term_name()
+  {
+    static const char* unsupported_term[] =
+    {
+      "dumb",
+      "cons25",
+      "emacs",
+      NULL
+    };
+    auto term = std::getenv("TERM");
+
+    if (!term)
+    {
+      return false;
+    }
+    for (int i = 0; unsupported_term[i]; ++i)
+    {
+      if (!::strcasecmp(term, unsupported_term[i]))
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  template<class String>
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::input_no_tty(String& line)
+  {
+    line.clear();
+    for (;;)
+    {
+      const auto c = std::fgetc(stdin);
+
+      if (c == EOF || c == '\n')
+      {
+        return c != EOF || !line.empty();
+      }
+      line.append(1, static_cast<char>(c));
+    }
+  }
+
+  template<class String>
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::read_line(const std::string& prompt,
+                               String& buffer,
+                               std::string_view& line)
+  {
+    if (!::isatty(STDIN_FILENO))
+    {
+      // Not a TTY: Read from file / pipe. In this mode we don't want any
+      // limit to the line size, so we call a function to handle that.
+      if (m_read_ahead)
+      {
+        return input_read_ahead(line);
+      }
+      else if (!input_no_tty(buffer))
+      {
+        return false;
+      }
+    }
+    else if (is_unsupported_term())
+    {
+      char buf[PEELO_PROMPT_MAX_LINE];
+      std::size_t length;
+
+      std::printf("%s", prompt.c_str());
+      std::fflush(stdout);
+      if (!std::fgets(buf, PEELO_PROMPT_MAX_LINE, stdin))
+      {
+        return false;
+      }
+      length = std::strlen(buf);
+      while (length && (buf[length-1] == '\n' || buf[length-1] == '\r'))
+      {
+        --length;
+        buf[length] = '\0';
+      }
+      buffer.assign(buf, length);
+    }
+    else if (!input_raw(prompt, buffer))
+    {
+      return false;
+    }
+    line = buffer;
+
+    return true;
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::input_read_ahead(std::string_view& line)
+  {
+    if (!m_line_reader)
+    {
+      m_line_reader = std::make_unique<line_reader>(STDIN_FILENO);
+    }
+
+    return m_line_reader->next(line);
+  }
+
+  template<class String>
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::input_raw(const std::string& prompt, String& line)
+  {
+    bool result;
+
+    if (!enable_raw_mode(STDIN_FILENO))
+    {
+      return false;
+    }
+    if (!m_terminal_probed)
+    {
+      probe_terminal(STDIN_FILENO, STDOUT_FILENO);
+    }
+    result = edit(STDIN_FILENO, STDOUT_FILENO, prompt, line);
+    disable_raw_mode(STDIN_FILENO);
+    std::printf("\n");
+
+    return result;
+  }
+
+  template<class String>
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::edit(int stdin_fd,
+                          int stdout_fd,
+                          const std::string& prompt,
+                          String& line)
+  {
+    struct state state(m_resource);
+
+    begin_state(
+      state,
+      stdin_fd,
+      stdout_fd,
+      prompt,
+      get_columns(stdin_fd, stdout_fd),
+      get_rows(stdout_fd)
+    );
+    if (m_recorder)
+    {
+      m_recorder->line(state.cols, state.rows, prompt);
+    }
+
+    if (!write_output(state, prompt.c_str(), prompt.length()))
+    {
+      return false;
+    }
+
+    for (;;)
+    {
+      char c;
+
+      // Render the latest state if frames were dropped while the terminal
+      // was busy and we have caught up with the input.
+      if (state.refresh_pending && !has_pending_input(state.ifd))
+      {
+        refresh(state);
+      }
+
+      speculate(state);
+
+      // Escape key on its own closes the completion menu. It's told apart
+      // from escape sequences by the rest of the sequence not arriving
+      // right after it.
+      if (state.menu_active
+          && state.escape
+          && state.seq_len == 0
+          && !has_pending_input(state.ifd, PEELO_PROMPT_ESCAPE_TIMEOUT))
+      {
+        close_menu(state);
+      }
+
+      if (read_input(state.ifd, c) <= 0)
+      {
+        line.assign(state.buf, state.len);
+
+        return true;
+      }
+      if (m_recorder)
+      {
+        m_recorder->input(&c, 1, std::chrono::steady_clock::now());
+      }
+
+      if (const auto result = process(state, c))
+      {
+        if (*result)
+        {
+          line.assign(state.buf, state.len);
+        }
+
+        return *result;
+      }
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::begin_state(struct state& state,
+                                 int ifd,
+                                 int ofd,
+                                 const std::string& prompt,
+                                 std::size_t cols,
+                                 std::size_t rows)
+  {
+    // Populate the input state that we pass to functions implementing
+    // specific editing functionalities.
+    state.ifd = ifd;
+    state.ofd = ofd;
+    state.buflen = PEELO_PROMPT_MAX_LINE;
+    state.prompt = prompt;
+    state.pos = 0;
+    state.scroll = 0;
+    state.len = 0;
+    state.cols = cols;
+    state.rows = rows;
+    compute_prompt_layout(prompt, state.cols, state.layout);
+    state.top = 0;
+    state.cursor_row = state.layout.breaks.size();
+    state.cursor_col = state.layout.width
+      - state.layout.breaks.size() * state.cols;
+    state.lines.assign(1, { 0, state.layout.width / state.cols + 1 });
+    state.checkpoints.clear();
+    state.tokens.clear();
+    ++m_buffer_version;
+    state.history_index = 0;
+    state.refresh_pending = false;
+    state.screen.valid = false;
+    state.escape = false;
+    state.seq_len = 0;
+    state.completions.clear();
+    state.cycling = false;
+    state.menu_active = false;
+    state.menu_rows = 0;
+    state.output = nullptr;
+
+    // Buffer starts empty.
+    state.buf[0] = '\0';
+    // Make sure there is always space for the nulterm.
+    --state.buflen;
+
+    // Latest history entry is always our current buffer, that initially is
+    // just an empty string.
+    m_history_container.emplace_back();
+  }
+
+  PEELO_PROMPT_INLINE
+  std::optional<bool> prompt::impl::process(struct state& state, char c)
+  {
+    const trace_scope scope(
+      m_trace.get(),
+      "dispatch",
+      static_cast<unsigned char>(c)
+    );
+
+    if (state.escape)
+    {
+      state.seq[state.seq_len++] = c;
+
+      // Extended escape sequences have one additional byte.
+      if (state.seq_len < 2
+          || (state.seq_len == 2
+            && state.seq[0] == '['
+            && std::isdigit(static_cast<unsigned char>(state.seq[1]))))
+      {
+        return std::optional<bool>();
+      }
+      state.escape = false;
+      if (state.menu_active)
+      {
+        menu_escape(state);
+      } else {
+        handle_esc(state);
+      }
+      state.seq_len = 0;
+
+      return std::optional<bool>();
+    }
+
+    // Keys used for choosing a completion are consumed, other keys accept
+    // the completion and are then processed as usual.
+    if ((state.menu_active && menu_key(state, c))
+        || (state.cycling && cycle_key(state, c)))
+    {
+      return std::optional<bool>();
+    }
+
+    // Only autocomplete when the callback is set.
+    if (c == static_cast<int>(key::tab) && m_completion_callback)
+    {
+      start_completion(state);
+
+      return std::optional<bool>();
+    }
+
+    switch (c)
+    {
+      case static_cast<int>(key::ctrl_j):
+        // Insert a newline in multi line mode, otherwise act as enter.
+        if (m_multi_line)
+        {
+          if (!insert(state, '\n'))
+          {
+            return std::optional<bool>(false);
+          }
+          break;
+        }
+        [[fallthrough]];
+
+      case static_cast<int>(key::enter):
+        // Continue on the next line if the input is incomplete.
+        if (m_multi_line
+            && m_input_complete_callback
+            && !is_input_complete(state))
+        {
+          if (!insert(state, '\n'))
+          {
+            return std::optional<bool>(false);
+          }
+          break;
+        }
+        if (!m_history_container.empty())
+        {
+          m_history_container.pop_back();
+        }
+        // The accepted line is left on the screen, so the refreshes below
+        // cannot be dropped even if the rest of a paste is still pending.
+        if (m_multi_line && state.pos != state.len)
+        {
+          state.pos = state.len;
+          refresh(state, true);
+        }
+        if (m_hints_callback)
+        {
+          // Force a refresh without hints to leave the previous line as
+          // the user typed it after a newline.
+          const auto callback = m_hints_callback;
+
+          m_hints_callback.reset();
+          refresh(state, true);
+          m_hints_callback = callback;
+        }
+        else if (state.refresh_pending)
+        {
+          refresh(state, true);
+        }
+        return std::optional<bool>(true);
+
+      case static_cast<int>(key::ctrl_c):
+        errno = EAGAIN;
+        return std::optional<bool>(false);
+
+      case static_cast<int>(key::backspace):
+      case static_cast<int>(key::ctrl_h):
+        delete_previous_char(state);
+        break;
+
+      case static_cast<int>(key::ctrl_d):
+        // Remove character at the right of the cursor, or if the line is
+        // empty, act as end-of-file.
+        if (state.len > 0)
+        {
+          delete_next_char(state);
+        } else {
+          if (!m_history_container.empty())
+          {
+            m_history_container.pop_back();
+          }
+
+          return std::optional<bool>(false);
+        }
+        break;
+
+      case static_cast<int>(key::ctrl_t):
+        transpose_characters(state);
+        break;
+
+      case static_cast<int>(key::ctrl_b):
+        move_left(state);
+        break;
+
+      case static_cast<int>(key::ctrl_f):
+        move_right(state);
+        break;
+
+      case static_cast<int>(key::ctrl_p):
+        move_vertical(state, false);
+        break;
+
+      case static_cast<int>(key::ctrl_n):
+        move_vertical(state, true);
+        break;
+
+      case static_cast<int>(key::esc):
+        state.escape = true;
+        state.seq_len = 0;
+        break;
+
+      case static_cast<int>(key::ctrl_u):
+        kill_line(state);
+        break;
+
+      case static_cast<int>(key::ctrl_k):
+        kill_end_of_line(state);
+        break;
+
+      case static_cast<int>(key::ctrl_a):
+        move_home(state);
+        break;
+
+      case static_cast<int>(key::ctrl_e):
+        move_end(state);
+        break;
+
+      case static_cast<int>(key::ctrl_l):
+        write_output(state, "\033[H\033[2J", 7);
+        state.screen.valid = false;
+        state.cursor_row = 0;
+        state.cursor_col = 0;
+        refresh(state);
+        break;
+
+      case static_cast<int>(key::ctrl_w):
+        delete_previous_word(state);
+        break;
+
+      default:
+        if (!insert(state, c))
+        {
+          return std::optional<bool>(false);
+        }
+        break;
+    }
+
+    return std::optional<bool>();
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::is_input_complete(struct state& state)
+  {
+    const trace_scope scope(m_trace.get(), "input_complete");
+
+    return (*m_input_complete_callback)(
+      std::string_view(state.buf, state.len),
+      lex(state)
+    );
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::write_output(struct state& state,
+                                  const char* data,
+                                  std::size_t length)
+  {
+    if (state.output)
+    {
+      state.output->append(data, length);
+
+      return true;
+    }
+
+    const trace_scope scope(m_trace.get(), "write", length);
+
+    return ::write(state.ofd, data, length) != -1;
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::write_frame(struct state& state, frame& buffer)
+  {
+    if (state.output)
+    {
+      buffer.append_to(*state.output);
+
+      return true;
+    }
+
+    const trace_scope scope(m_trace.get(), "write");
+
+    return buffer.write(state.ofd);
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::enable_raw_mode(int fd)
+  {
+    ::termios raw;
+
+    if (!::isatty(STDIN_FILENO))
+    {
+      return false;
+    }
+
+    if (::tcgetattr(fd, &m_original_termios) == -1)
+    {
+      return false;
+    }
+
+    // Modify the original one.
+    raw = m_original_termios;
+
+    // Input modes: No break, no CR to NL, no parity check, no strip char, no
+    // start/stop output control.
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+
+    // Output modes: Disable post processing.
+    raw.c_oflag &= ~(OPOST);
+
+    // Control modes: Set 8 bit chars.
+    raw.c_cflag |= (CS8);
+
+    // Local modes: Echoing off, canonical off, no extended functions, no
+    // signal chars (^Z, ^C).
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+
+    // Control chars: Set return condition: min number of bytes and timer. We
+    // want to read to return every single byte, without timeout.
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+
+    // Put terminal in raw mode after flushing.
+    if (::tcsetattr(fd, TCSAFLUSH, &raw) < 0)
+    {
+      return false;
+    }
+
+    m_raw_mode = true;
+
+    return true;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::disable_raw_mode(int fd)
+  {
+    if (m_raw_mode)
+    {
+      ::tcsetattr(fd, TCSAFLUSH, &m_original_termios);
+      m_raw_mode = false;
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::refresh(struct state& state, bool force)
+  {
+    // If the terminal is still busy with the previous frames and there is
+    // more input waiting to be processed, this frame would be superseded
+    // anyway, so it's dropped. The latest state is rendered once we have
+    // caught up with the input.
+    if (!force
+        && has_pending_input(state.ifd)
+        && is_output_congested(state.ofd))
+    {
+      state.refresh_pending = true;
+      return;
+    }
+    state.refresh_pending = false;
+
+    const trace_scope scope(m_trace.get(), "frame");
+
+    if (m_multi_line)
+    {
+      refresh_multi_line(state);
+    } else {
+      refresh_single_line(state);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::begin_frame(frame& buffer) const
+  {
+    if (m_capabilities.synchronized_output)
+    {
+      buffer.append("\033[?2026h", 8);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::end_frame(frame& buffer) const
+  {
+    if (m_capabilities.synchronized_output)
+    {
+      buffer.append("\033[?2026l", 8);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::compute_prompt_layout(std::string_view prompt,
+                                           std::size_t cols,
+                                           prompt_layout& layout)
+  {
+    const auto length = prompt.length();
+    std::size_t col = 0;
+
+    layout.escapes.clear();
+    layout.breaks.clear();
+    layout.width = 0;
+    for (std::size_t i = 0; i < length;)
+    {
+      const auto c = static_cast<unsigned char>(prompt[i]);
+      auto end = i + 1;
+
+      if (c == '\033' && end < length)
+      {
+        if (prompt[end] == '[')
+        {
+          // CSI: parameters and intermediate bytes followed by final byte.
+          for (++end; end < length; ++end)
+          {
+            if (prompt[end] >= 0x40 && prompt[end] <= 0x7e)
+            {
+              ++end;
+              break;
+            }
+          }
+        }
+        else if (prompt[end] == ']')
+        {
+          // OSC: terminated by BEL or ST.
+          for (++end; end < length; ++end)
+          {
+            if (prompt[end] == '\007')
+            {
+              ++end;
+              break;
+            }
+            else if (prompt[end] == '\033' &&
+                     end + 1 < length &&
+                     prompt[end + 1] == '\\')
+            {
+              end += 2;
+              break;
+            }
+          }
+        } else {
+          ++end;
+        }
+        layout.escapes.emplace_back(i, end - i);
+      }
+      else if (c == '\001')
+      {
+        end = prompt.find('\002', end);
+        end = end == std::string::npos ? length : end + 1;
+        layout.escapes.emplace_back(i, end - i);
+      }
+      else if (c >= 0x20 && c != 0x7f && (c & 0xc0) != 0x80)
+      {
+        if (col == cols)
+        {
+          layout.breaks.push_back(i);
+          col = 0;
+        }
+        ++col;
+        ++layout.width;
+      }
+      i = end;
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::refresh_single_line(struct state& state)
+  {
+    const auto plen = state.layout.width;
+    // Columns available for the buffer.
+    const auto avail = state.cols > plen ? state.cols - plen : 1;
+    std::size_t len;
+    std::size_t width;
+    auto& buffer = m_frame;
+
+    buffer.clear();
+    begin_frame(buffer);
+
+    // Scroll the view only when the cursor leaves it, or when there is
+    // text hidden on the left side while there would be room to show it.
+    if (state.pos < state.scroll)
+    {
+      state.scroll = state.pos;
+    }
+    else if (state.pos - state.scroll >= avail)
+    {
+      state.scroll = state.pos - avail + 1;
+    }
+    if (state.scroll > 0 && state.len + 1 < state.scroll + avail)
+    {
+      state.scroll = state.len + 1 > avail ? state.len + 1 - avail : 0;
+    }
+    len = std::min(state.len - state.scroll, avail);
+
+    // Cursor to left edge.
+    buffer.append(1, '\r');
+
+    // Write the prompt and the current buffer content.
+    buffer.reference(state.prompt.c_str(), state.prompt.length());
+    buffer.reference(state.buf + state.scroll, len);
+
+    // Show hits if any.
+    width = plen + len + show_hints(state.hint, state);
+    buffer.append(state.hint);
+
+    // Erase to right, unless the line is full.
+    if (width < state.cols)
+    {
+      buffer.append("\033[K", 3);
+    }
+
+    // Move cursor to original position.
+    move_cursor(
+      buffer,
+      state.cols,
+      0,
+      width,
+      0,
+      plen + state.pos - state.scroll
+    );
+
+    end_frame(buffer);
+
+    write_frame(state, buffer);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::refresh_multi_line(struct state& state)
+  {
+    const auto cols = state.cols;
+    const auto cursor = locate(state, state.pos);
+    auto& buffer = m_frame;
+    auto& visible = m_visible_rows;
+    auto& screen = state.screen;
+    std::size_t rows = 0;
+    std::size_t height;
+    std::size_t hint_width = 0;
+    std::size_t hint_row = SIZE_MAX;
+
+    buffer.clear();
+    begin_frame(buffer);
+
+    for (const auto& line : state.lines)
+    {
+      rows += line.rows;
+    }
+    // Rows taken by the completion menu are left out of the viewport, so
+    // that drawing the menu does not scroll the terminal.
+    height = state.rows > 0
+      ? std::min(state.rows - state.menu_rows, rows)
+      : rows;
+
+    // Move the viewport only when the cursor leaves it, or when it shows
+    // empty rows after the text.
+    if (cursor.first < state.top)
+    {
+      state.top = cursor.first;
+    }
+    else if (cursor.first >= state.top + height)
+    {
+      state.top = cursor.first - height + 1;
+    }
+    state.top = std::min(state.top, rows - height);
+    get_visible_rows(state, height, visible);
+
+    // Hints are shown only when the whole text fits on a single row.
+    if (state.lines.size() == 1)
+    {
+      hint_width = show_hints(state.hint, state);
+      hint_row = 0;
+    } else {
+      state.hint.clear();
+    }
+
+    if (screen.valid && screen.top == state.top)
+    {
+      refresh_changed_rows(state, hint_row, hint_width);
+    } else {
+      // Clear all the rows used before. To do so go to the first row and
+      // erase everything below it.
+      move_cursor(
+        buffer,
+        cols,
+        state.cursor_row,
+        state.cursor_col,
+        0,
+        0
+      );
+      buffer.append("\033[J", 3);
+
+      // Write the visible rows.
+      for (std::size_t i = 0; i < visible.size(); ++i)
+      {
+        if (i > 0)
+        {
+          buffer.append("\r\n", 2);
+        }
+        write_row(state, i, i == hint_row);
+      }
+      state.cursor_row = visible.size() - 1;
+      state.cursor_col = visible.back().col + visible.back().length
+        + (hint_row == state.cursor_row ? hint_width : 0);
+    }
+
+    // Move cursor to right position.
+    move_cursor(
+      buffer,
+      cols,
+      state.cursor_row,
+      state.cursor_col,
+      cursor.first - state.top,
+      cursor.second
+    );
+    state.cursor_row = cursor.first - state.top;
+    state.cursor_col = cursor.second;
+
+    // Remember what is on the screen for the next refresh.
+    screen.valid = true;
+    screen.top = state.top;
+    screen.rows.resize(visible.size());
+    for (std::size_t i = 0; i < visible.size(); ++i)
+    {
+      screen.rows[i].assign(state.buf + visible[i].offset, visible[i].length);
+    }
+    screen.hint.swap(state.hint);
+    screen.hint_width = hint_width;
+
+    end_frame(buffer);
+
+    write_frame(state, buffer);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::refresh_changed_rows(struct state& state,
+                                          std::size_t hint_row,
+                                          std::size_t hint_width)
+  {
+    static const std::pmr::string no_hint;
+    const auto cols = state.cols;
+    const auto& visible = m_visible_rows;
+    const auto& screen = state.screen;
+    auto& buffer = m_frame;
+
+    for (std::size_t i = 0; i < visible.size(); ++i)
+    {
+      const auto& row = visible[i];
+      const auto text = state.buf + row.offset;
+      const auto& hint = i == hint_row ? state.hint : no_hint;
+      const auto width = i == hint_row ? hint_width : 0;
+      std::size_t from = 0;
+      std::size_t to = row.length;
+
+      if (i >= screen.rows.size())
+      {
+        // The row does not exist on the screen yet, so it's created by
+        // moving down from the previous row.
+        if (state.cursor_row != i - 1)
+        {
+          move_cursor(buffer, cols, state.cursor_row, state.cursor_col,
+                      i - 1, 0);
+        }
+        buffer.append("\r\n", 2);
+        write_row(state, i, i == hint_row);
+        state.cursor_row = i;
+        state.cursor_col = row.col + row.length + width;
+        continue;
+      }
+
+      const auto& old_text = screen.rows[i];
+      const auto& old_hint = i == 0 ? screen.hint : no_hint;
+      const auto old_width = i == 0 ? screen.hint_width : 0;
+
+      // Find the first character which differs.
+      while (from < row.length &&
+             from < old_text.length() &&
+             text[from] == old_text[from])
+      {
+        ++from;
+      }
+      if (from == row.length &&
+          from == old_text.length() &&
+          hint == old_hint)
+      {
+        continue;
+      }
+
+      // If the length stays the same, find the last character which
+      // differs as well, so that unchanged characters after it are not
+      // rewritten.
+      if (row.length == old_text.length() && hint == old_hint)
+      {
+        while (to > from && text[to - 1] == old_text[to - 1])
+        {
+          --to;
+        }
+      }
+
+      move_cursor(
+        buffer,
+        cols,
+        state.cursor_row,
+        state.cursor_col,
+        i,
+        row.col + from
+      );
+      buffer.reference(text + from, to - from);
+      state.cursor_row = i;
+      state.cursor_col = row.col + to;
+      if (to == row.length)
+      {
+        buffer.append(hint);
+        state.cursor_col += width;
+
+        // Erase the rest of the row if the text got shorter.
+        if (row.length + width < old_text.length() + old_width)
+        {
+          buffer.append("\033[K", 3);
+        }
+      }
+    }
+
+    // Erase the rows which are no longer used.
+    if (visible.size() < screen.rows.size())
+    {
+      move_cursor(
+        buffer,
+        cols,
+        state.cursor_row,
+        state.cursor_col,
+        visible.size(),
+        0
+      );
+      buffer.append("\033[J", 3);
+      state.cursor_row = visible.size();
+      state.cursor_col = 0;
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::write_row(const struct state& state,
+                               std::size_t index,
+                               bool hint)
+  {
+    const auto& prompt = state.prompt;
+    const auto& breaks = state.layout.breaks;
+    const auto& row = m_visible_rows[index];
+    const auto prompt_row = state.top + index;
+    auto& buffer = m_frame;
+
+    if (state.layout.width > 0 && prompt_row <= breaks.size())
+    {
+      const auto start = prompt_row > 0 ? breaks[prompt_row - 1] : 0;
+      const auto end = prompt_row < breaks.size()
+        ? breaks[prompt_row]
+        : prompt.length();
+
+      if (index == 0)
+      {
+        for (const auto& escape : state.layout.escapes)
+        {
+          if (escape.first >= start)
+          {
+            break;
+          }
+          buffer.reference(prompt.c_str() + escape.first, escape.second);
+        }
+      }
+      buffer.reference(prompt.c_str() + start, end - start);
+    }
+    buffer.reference(state.buf + row.offset, row.length);
+    if (hint)
+    {
+      buffer.append(state.hint);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::get_visible_rows(const struct state& state,
+                                      std::size_t height,
+                                      std::pmr::vector<visible_row>& visible)
+  {
+    const auto cols = state.cols;
+    const auto bottom = state.top + height;
+    std::size_t row = 0;
+    std::size_t start = 0;
+
+    visible.clear();
+    for (std::size_t i = 0; i < state.lines.size() && row < bottom; ++i)
+    {
+      const auto& line = state.lines[i];
+      const auto prefix = i > 0 ? 0 : state.layout.width;
+
+      // Skip the rows of a long line scrolled above the screen at once.
+      for (auto j = row < state.top ? state.top - row : 0;
+           j < line.rows && row + j < bottom;
+           ++j)
+      {
+        const auto cell = j * cols;
+        const auto from = std::min(
+          cell > prefix ? cell - prefix : 0,
+          line.length
+        );
+        const auto to = cell + cols > prefix
+          ? std::min(cell + cols - prefix, line.length)
+          : from;
+        visible.push_back({
+          start + from,
+          to - from,
+          prefix > cell ? std::min(prefix - cell, cols) : 0
+        });
+      }
+      row += line.rows;
+      start += line.length + 1;
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  std::pair<std::size_t, std::size_t>
+  prompt::impl::locate(const struct state& state, std::size_t offset)
+  {
+    const auto line = find_line(state, offset);
+    std::size_t row = 0;
+    std::size_t cell = offset - line.second;
+
+    for (std::size_t i = 0; i < line.first; ++i)
+    {
+      row += state.lines[i].rows;
+    }
+    if (line.first == 0)
+    {
+      cell += state.layout.width;
+    }
+
+    return { row + cell / state.cols, cell % state.cols };
+  }
+
+  PEELO_PROMPT_INLINE
+  std::pair<std::size_t, std::size_t> prompt::impl::find_line(
+    const struct state& state,
+    std::size_t offset
+  )
+  {
+    const auto& lines = state.lines;
+    std::size_t index = 0;
+    std::size_t start = 0;
+
+    while (index + 1 < lines.size() && start + lines[index].length < offset)
+    {
+      start += lines[index++].length + 1;
+    }
+
+    return { index, start };
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::buffer_changed(struct state& state,
+                                    std::size_t offset,
+                                    std::size_t removed,
+                                    std::size_t inserted)
+  {
+    const auto line = find_line(state, offset).first;
+
+    // Completions computed for the previous text are no longer usable.
+    ++m_buffer_version;
+
+    // Lexer states at the end of the lines preceding the change remain
+    // valid.
+    if (line < state.checkpoints.size())
+    {
+      state.checkpoints.resize(line);
+    }
+    update_lines(state, offset, removed, inserted);
+    update_tokens(state, offset, removed, inserted);
+  }
+
+  PEELO_PROMPT_INLINE
+  prompt::input_context prompt::impl::get_context(const struct state& state)
+  {
+    return input_context(
+      std::string_view(state.buf, state.len),
+      state.pos,
+      state.tokens
+    );
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::update_tokens(struct state& state,
+                                   std::size_t offset,
+                                   std::size_t removed,
+                                   std::size_t inserted)
+  {
+    auto& tokens = state.tokens;
+    // Tokens are sorted and do not overlap, so the first one touched by
+    // the change can be searched for instead of scanning every token.
+    const auto first = std::partition_point(
+      std::begin(tokens),
+      std::end(tokens),
+      [offset](const token& t)
+      {
+        return t.offset + t.length < offset;
+      }
+    );
+    auto old = first;
+    auto pos = first != std::end(tokens)
+      ? std::min(first->offset, offset)
+      : offset;
+    std::pmr::vector<token> scanned(tokens.get_allocator());
+
+    for (;;)
+    {
+      while (pos < state.len
+             && std::isspace(static_cast<unsigned char>(state.buf[pos])))
+      {
+        ++pos;
+      }
+      if (pos >= offset + inserted)
+      {
+        while (old != std::end(tokens)
+               && (old->offset < offset + removed
+                 || old->offset + inserted < pos + removed))
+        {
+          ++old;
+        }
+        if (old != std::end(tokens)
+            && old->offset + inserted == pos + removed)
+        {
+          break;
+        }
+      }
+      if (pos >= state.len)
+      {
+        old = std::end(tokens);
+        break;
+      }
+
+      const auto end = scan_token(state, pos);
+
+      scanned.push_back({ pos, end - pos });
+      pos = end;
+    }
+    if (inserted != removed)
+    {
+      for (auto it = old; it != std::end(tokens); ++it)
+      {
+        it->offset = it->offset + inserted - removed;
+      }
+    }
+    tokens.insert(
+      tokens.erase(first, old),
+      std::begin(scanned),
+      std::end(scanned)
+    );
+  }
+
+  PEELO_PROMPT_INLINE
+  std::size_t prompt::impl::scan_token(const struct state& state,
+                                        std::size_t pos)
+  {
+    char quote = 0;
+
+    while (pos < state.len)
+    {
+      const auto c = state.buf[pos];
+
+      if (c == '\\' && quote != '\'')
+      {
+        pos = std::min(pos + 2, state.len);
+        continue;
+      }
+      else if (quote)
+      {
+        if (c == quote)
+        {
+          quote = 0;
+        }
+      }
+      else if (std::isspace(static_cast<unsigned char>(c)))
+      {
+        break;
+      }
+      else if (c == '"' || c == '\'')
+      {
+        quote = c;
+      }
+      ++pos;
+    }
+
+    return pos;
+  }
+
+  PEELO_PROMPT_INLINE
+  prompt::lexer_state prompt::impl::lex(struct state& state)
+  {
+    auto result = state.checkpoints.empty()
+      ? lexer_state{ 0, 0, 0, false, 0 }
+      : state.checkpoints.back();
+
+    while (result.offset < state.len)
+    {
+      const auto c = state.buf[result.offset++];
+
+      if (result.escape)
+      {
+        result.escape = false;
+      }
+      else if (c == '\\')
+      {
+        result.escape = true;
+      }
+      else if (result.quote)
+      {
+        if (c == result.quote)
+        {
+          result.quote = 0;
+        }
+      }
+      else if (c == '"' || c == '\'' || c == '`')
+      {
+        result.quote = c;
+      }
+      else if (c == '(' || c == '[' || c == '{')
+      {
+        ++result.depth;
+      }
+      else if (c == ')' || c == ']' || c == '}')
+      {
+        --result.depth;
+      }
+      if (!result.quote && !std::isspace(static_cast<unsigned char>(c)))
+      {
+        result.last = c;
+      }
+      if (c == '\n')
+      {
+        state.checkpoints.push_back(result);
+      }
+    }
+
+    return result;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::update_lines(struct state& state,
+                                  std::size_t offset,
+                                  std::size_t removed,
+                                  std::size_t inserted)
+  {
+    auto& lines = state.lines;
+    const auto first = find_line(state, offset);
+    auto last = first;
+    std::size_t end;
+    std::size_t index = first.first;
+
+    // Find the last line touched by the replacement.
+    while (last.first + 1 < lines.size() &&
+           last.second + lines[last.first].length < offset + removed)
+    {
+      last.second += lines[last.first++].length + 1;
+    }
+    end = last.second + lines[last.first].length + inserted - removed;
+
+    // Lay out the lines between the beginning of the first line and the end
+    // of the last line again, replacing the old layouts.
+    for (auto start = first.second;; ++index)
+    {
+      // Text around the inserted text belongs to the old lines, so a
+      // newline can only be found in the inserted text.
+      const auto from = std::max(start, offset);
+      const auto newline = from < offset + inserted
+        ? static_cast<const char*>(
+          std::memchr(state.buf + from, '\n', offset + inserted - from)
+        )
+        : nullptr;
+      const auto length = newline
+        ? static_cast<std::size_t>(newline - (state.buf + start))
+        : end - start;
+      const line_layout layout = {
+        length,
+        ((index > 0 ? 0 : state.layout.width) + length) / state.cols + 1
+      };
+
+      if (index <= last.first)
+      {
+        lines[index] = layout;
+      } else {
+        lines.insert(std::begin(lines) + index, layout);
+        ++last.first;
+      }
+      if (!newline)
+      {
+        break;
+      }
+      start += length + 1;
+    }
+    if (index < last.first)
+    {
+      lines.erase(
+        std::begin(lines) + index + 1,
+        std::begin(lines) + last.first + 1
+      );
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::move_cursor(frame& buffer,
+                                 std::size_t cols,
+                                 std::size_t from_row,
+                                 std::size_t from_col,
+                                 std::size_t to_row,
+                                 std::size_t to_col)
+  {
+    if (to_row < from_row)
+    {
+      append_csi(buffer, from_row - to_row, 'A');
+    }
+    else if (to_row > from_row)
+    {
+      const auto n = to_row - from_row;
+
+      // Line feed moves just one row down, as output post processing is
+      // disabled in raw mode.
+      if (n <= csi_length(n))
+      {
+        buffer.append(n, '\n');
+      } else {
+        append_csi(buffer, n, 'B');
+      }
+    }
+
+    if (from_col == to_col && from_col < cols)
+    {
+      return;
+    }
+
+    // Carriage return followed by move right, or absolute column.
+    auto cost = 1 + (to_col ? csi_length(to_col) : 0);
+    auto method = 'r';
+
+    if (csi_length(to_col + 1) < cost)
+    {
+      cost = csi_length(to_col + 1);
+      method = 'G';
+    }
+    if (from_col < cols)
+    {
+      // Relative movement to left or right, or backspaces.
+      if (to_col > from_col && csi_length(to_col - from_col) < cost)
+      {
+        cost = csi_length(to_col - from_col);
+        method = 'C';
+      }
+      else if (to_col < from_col)
+      {
+        if (from_col - to_col < cost)
+        {
+          cost = from_col - to_col;
+          method = 'b';
+        }
+        if (csi_length(from_col - to_col) < cost)
+        {
+          cost = csi_length(from_col - to_col);
+          method = 'D';
+        }
+      }
+    }
+
+    switch (method)
+    {
+      case 'r':
+        buffer.append(1, '\r');
+        if (to_col)
+        {
+          append_csi(buffer, to_col, 'C');
+        }
+        break;
+
+      case 'G':
+        append_csi(buffer, to_col + 1, 'G');
+        break;
+
+      case 'C':
+        append_csi(buffer, to_col - from_col, 'C');
+        break;
+
+      case 'b':
+        buffer.append(from_col - to_col, '\b');
+        break;
+
+      case 'D':
+        append_csi(buffer, from_col - to_col, 'D');
+        break;
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  std::size_t prompt::impl::csi_length(std::size_t n)
+  {
+    std::size_t length = 3;
+
+    if (n > 1)
+    {
+      for (; n > 0; n /= 10)
+      {
+        ++length;
+      }
+    }
+
+    return length;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::append_csi(frame& buffer, std::size_t n, char final)
+  {
+    buffer.append("\033[", 2);
+    if (n > 1)
+    {
+      buffer.append(std::to_string(n));
+    }
+    buffer.append(1, final);
+  }
+
+  PEELO_PROMPT_INLINE
+  int prompt::impl::get_cursor_position(int ifd, int ofd)
+  {
+    char buffer[32];
+    int cols;
+    int rows;
+    std::size_t i = 0;
+
+    // Report cursor location.
+    if (::write(ofd, "\033[6n", 4) != 4)
+    {
+      return -1;
+    }
+
+    // Read the response: ESC [ rows ; cols R
+    while (i < sizeof(buffer))
+    {
+      if (::read(ifd, buffer + i, 1) != 1 || buffer[i] == 'R')
+      {
+        break;
+      }
+      ++i;
+    }
+    buffer[i] = '\0';
+
+    // Parse it.
+    if (buffer[0] != static_cast<int>(key::esc) ||
+        buffer[1] != '[' ||
+        std::sscanf(buffer + 2, "%d;%d", &rows, &cols) != 2)
+    {
+      return -1;
+    }
+
+    return cols;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::probe_terminal(int ifd, int ofd)
+  {
+    static const char query[] =
+      "\033[?2004$p\033[?2026$p\033[?u\033[>0q\033[c";
+    const auto deadline = std::chrono::steady_clock::now()
+      + std::chrono::milliseconds(PEELO_PROMPT_PROBE_TIMEOUT);
+    const auto colorterm = std::getenv("COLORTERM");
+
+    m_terminal_probed = true;
+    m_capabilities.truecolor = colorterm && (
+      !std::strcmp(colorterm, "truecolor") ||
+      !std::strcmp(colorterm, "24bit")
+    );
+
+    if (::write(ofd, query, sizeof(query) - 1) != sizeof(query) - 1)
+    {
+      return;
+    }
+    m_awaiting_reports = true;
+    // Answers arriving after the probe has timed out are still filtered
+    // from the input until this deadline.
+    m_reports_deadline = std::chrono::steady_clock::now()
+      + std::chrono::milliseconds(PEELO_PROMPT_LATE_REPORT_TIMEOUT);
+
+    // Read until the device attributes report arrives or the terminal
+    // stops responding.
+    while (m_awaiting_reports)
+    {
+      const auto timeout = std::chrono::duration_cast<
+        std::chrono::milliseconds
+      >(deadline - std::chrono::steady_clock::now()).count();
+      ::pollfd pfd = { ifd, POLLIN, 0 };
+      char buffer[256];
+      ssize_t result;
+
+      if (timeout <= 0 ||
+          ::poll(&pfd, 1, static_cast<int>(timeout)) <= 0 ||
+          (result = ::read(ifd, buffer, sizeof(buffer))) <= 0)
+      {
+        break;
+      }
+      m_report_input.append(buffer, result);
+      filter_reports();
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::filter_reports()
+  {
+    std::size_t i = 0;
+
+    while (i < m_report_input.length())
+    {
+      const auto length = report_length(m_report_input, i);
+
+      if (length > 0)
+      {
+        // The device attributes report is the last one to arrive.
+        if (m_report_input[i + length - 1] == 'c')
+        {
+          m_awaiting_reports = false;
+        }
+        parse_report(std::string_view(m_report_input).substr(i, length));
+        i += length;
+      }
+      else if (m_awaiting_reports && is_partial_report(m_report_input, i))
+      {
+        break;
+      } else {
+        m_pending_input.append(1, m_report_input[i++]);
+      }
+    }
+    m_report_input.erase(0, i);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::end_partial_report()
+  {
+    if (m_report_input.compare(0, 3, "\033[?")
+        && m_report_input.compare(0, 4, "\033P>|"))
+    {
+      m_pending_input.append(m_report_input);
+    }
+    m_report_input.clear();
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::parse_report(std::string_view report)
+  {
+    const auto final = report.back();
+    int mode;
+    int value;
+
+    // XTVERSION: DCS > | text ST
+    if (report[1] == 'P')
+    {
+      static const char* truecolor_terminals[] =
+      {
+        "kitty",
+        "WezTerm",
+        "iTerm2",
+        "foot",
+        "ghostty",
+        "contour",
+        NULL
+      };
+
+      m_capabilities.version = report.substr(4, report.length() - 6);
+      for (int i = 0; truecolor_terminals[i]; ++i)
+      {
+        if (!m_capabilities.version.compare(
+              0,
+              std::strlen(truecolor_terminals[i]),
+              truecolor_terminals[i]
+            ))
+        {
+          m_capabilities.truecolor = true;
+        }
+      }
+    }
+    // Kitty keyboard protocol flags: CSI ? flags u
+    else if (final == 'u')
+    {
+      m_capabilities.kitty_keyboard = true;
+    }
+    // DECRPM: CSI ? mode ; value $ y
+    else if (final == 'y')
+    {
+      const auto end = report.data() + report.length();
+      const auto separator = std::from_chars(report.data() + 3, end, mode);
+
+      if (separator.ec != std::errc()
+          || separator.ptr == end
+          || *separator.ptr != ';'
+          || std::from_chars(separator.ptr + 1, end, value).ec != std::errc())
+      {
+        return;
+      }
+
+      // 1 and 2 mean that the mode is set or reset, 3 that it's
+      // permanently set. 0 and 4 mean that it cannot be used.
+      const bool supported = value >= 1 && value <= 3;
+
+      if (mode == 2004)
+      {
+        m_capabilities.bracketed_paste = supported;
+      }
+      else if (mode == 2026)
+      {
+        m_capabilities.synchronized_output = supported;
+      }
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  std::size_t prompt::impl::report_length(std::string_view input,
+                                          std::size_t offset)
+  {
+    const auto length = input.length();
+    auto i = offset + 3;
+
+    if (offset >= length)
+    {
+      return 0;
+    }
+    else if (!input.compare(offset, 4, "\033P>|"))
+    {
+      const auto end = input.find("\033\\", offset + 4);
+
+      return end == std::string_view::npos ? 0 : end + 2 - offset;
+    }
+    else if (input.compare(offset, 3, "\033[?"))
+    {
+      return 0;
+    }
+    while (i < length && (std::isdigit(input[i]) || input[i] == ';'))
+    {
+      ++i;
+    }
+    if (i < length && (input[i] == 'c' || input[i] == 'u'))
+    {
+      return i + 1 - offset;
+    }
+    else if (i + 1 < length && input[i] == '$' && input[i + 1] == 'y')
+    {
+      return i + 2 - offset;
+    }
+
+    return 0;
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::is_partial_report(std::string_view input,
+                                       std::size_t offset)
+  {
+    static const char dcs[] = "\033P>|";
+    static const char csi[] = "\033[?";
+    const auto rest = input.substr(offset);
+    auto i = sizeof(csi) - 1;
+
+    if (rest.length() < sizeof(dcs) - 1
+        && !rest.compare(0, rest.length(), dcs, rest.length()))
+    {
+      return true;
+    }
+    else if (!rest.compare(0, sizeof(dcs) - 1, dcs))
+    {
+      return rest.find("\033\\") == std::string_view::npos;
+    }
+    else if (rest.compare(0, sizeof(csi) - 1, csi))
+    {
+      return rest.length() < sizeof(csi) - 1
+        && !rest.compare(0, rest.length(), csi, rest.length());
+    }
+    while (i < rest.length() && (std::isdigit(rest[i]) || rest[i] == ';'))
+    {
+      ++i;
+    }
+
+    return i == rest.length() || (i + 1 == rest.length() && rest[i] == '$');
+  }
+
+  PEELO_PROMPT_INLINE
+  std::size_t prompt::impl::get_rows(int ofd)
+  {
+    ::winsize ws;
+
+    if (::ioctl(ofd, TIOCGWINSZ, &ws) == -1)
+    {
+      return 0;
+    }
+
+    return ws.ws_row;
+  }
+
+  PEELO_PROMPT_INLINE
+  int prompt::impl::get_columns(int ifd, int ofd)
+  {
+    ::winsize ws;
+
+    if (::ioctl(1, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
+    {
+      // ioctl() failed. Try to query the terminal itself.
+      int start;
+      int cols;
+
+      // Get the initial position so we can restore it later.
+      if ((start = get_cursor_position(ifd, ofd)) == -1)
+      {
+        goto FAILED;
+      }
+
+      // Go right margin and get position.
+      if (::write(ofd, "\033[999C", 6) != 6)
+      {
+        goto FAILED;
+      }
+
+      if ((cols = get_cursor_position(ifd, ofd)) == -1)
+      {
+        goto FAILED;
+      }
+
+      // Restore position.
+      if (cols > start)
+      {
+        char sequence[32];
+
+        std::snprintf(sequence, 32, "\033[%dD", cols - start);
+        [[maybe_unused]] const auto written = ::write(
+          ofd,
+          sequence,
+          std::strlen(sequence)
+        );
+      }
+
+      return cols;
+    } else {
+      return ws.ws_col;
+    }
+
+FAILED:
+    return 80;
+  }
+
+  PEELO_PROMPT_INLINE
+  ssize_t prompt::impl::read_input(int fd, char& c)
+  {
+    // Answers to the queries sent by probe_terminal() may arrive late over
+    // slow connections, or be split over several reads, so they are kept
+    // from being taken as input until the last one has arrived.
+    while (m_pending_input.empty() && m_awaiting_reports)
+    {
+      char buffer[256];
+      ssize_t result;
+
+      if (std::chrono::steady_clock::now() >= m_reports_deadline)
+      {
+        m_awaiting_reports = false;
+        end_partial_report();
+        break;
+      }
+      else if (!m_report_input.empty()
+               && !has_pending_input(fd, PEELO_PROMPT_PROBE_TIMEOUT))
+      {
+        end_partial_report();
+        continue;
+      }
+      else if ((result = ::read(fd, buffer, sizeof(buffer))) <= 0)
+      {
+        return result;
+      }
+      m_report_input.append(buffer, result);
+      filter_reports();
+    }
+    if (!m_pending_input.empty())
+    {
+      c = m_pending_input.front();
+      m_pending_input.erase(0, 1);
+
+      return 1;
+    }
+
+    return ::read(fd, &c, 1);
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::has_pending_input(int fd, int timeout) const
+  {
+    ::pollfd pfd = { fd, POLLIN, 0 };
+
+    return !m_pending_input.empty() || ::poll(&pfd, 1, timeout) > 0;
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::is_output_congested(int fd)
+  {
+    ::pollfd pfd = { fd, POLLOUT, 0 };
+#if defined(TIOCOUTQ)
+    int queued;
+
+    // Serial lines report the number of bytes waiting to be transmitted.
+    if (::ioctl(fd, TIOCOUTQ, &queued) == 0 && queued > 0)
+    {
+      return true;
+    }
+#endif
+
+    // Pseudo terminals and sockets stop accepting output once their
+    // buffers are full.
+    return ::poll(&pfd, 1, 0) == 0;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::beep(struct state& state)
+  {
+    if (state.output)
+    {
+      state.output->append(1, '\x7');
+    } else {
+      std::fprintf(stderr, "\x7");
+      std::fflush(stderr);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::insert(struct state& state, char c)
+  {
+    if (state.len < state.buflen)
+    {
+      if (state.len == state.pos)
+      {
+        state.buf[state.pos] = c;
+        ++state.pos;
+        ++state.len;
+        state.buf[state.len] = '\0';
+        buffer_changed(state, state.pos - 1, 0, 1);
+        if (!m_multi_line
+            && state.layout.width + state.len < state.cols
+            && !m_hints_callback
+            && !state.refresh_pending)
+        {
+          // Avoid a full update of the line in the trivial case.
+          if (!write_output(state, &c, 1))
+          {
+            return false;
+          }
+        } else {
+          refresh(state);
+        }
+      } else {
+        std::memmove(
+          static_cast<void*>(state.buf + state.pos + 1),
+          static_cast<const void*>(state.buf + state.pos),
+          state.len - state.pos
+        );
+        state.buf[state.pos] = c;
+        ++state.len;
+        ++state.pos;
+        state.buf[state.len] = '\0';
+        buffer_changed(state, state.pos - 1, 0, 1);
+        refresh(state);
+      }
+    }
+
+    return true;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::move_left(struct state& state)
+  {
+    if (state.pos > 0)
+    {
+      --state.pos;
+      refresh(state);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::move_right(struct state& state)
+  {
+    if (state.pos != state.len)
+    {
+      ++state.pos;
+      refresh(state);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::move_home(struct state& state)
+  {
+    const auto start = find_line(state, state.pos).second;
+
+    if (state.pos != start)
+    {
+      state.pos = start;
+      refresh(state);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::move_end(struct state& state)
+  {
+    const auto line = find_line(state, state.pos);
+    const auto end = line.second + state.lines[line.first].length;
+
+    if (state.pos != end)
+    {
+      state.pos = end;
+      refresh(state);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::move_vertical(struct state& state, bool direction)
+  {
+    const auto line = find_line(state, state.pos);
+    const auto column = state.pos - line.second;
+    std::size_t start;
+    std::size_t index;
+
+    if (direction ? line.first + 1 >= state.lines.size() : line.first == 0)
+    {
+      edit_history_next(state, direction);
+      return;
+    }
+
+    if (direction)
+    {
+      index = line.first + 1;
+      start = line.second + state.lines[line.first].length + 1;
+    } else {
+      index = line.first - 1;
+      start = line.second - state.lines[index].length - 1;
+    }
+    state.pos = start + std::min(column, state.lines[index].length);
+    refresh(state);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::edit_history_next(struct state& state, bool direction)
+  {
+    const auto size = m_history_container.size();
+
+    if (size < 2)
+    {
+      return;
+    }
+    // Update the current history entry before overwriting it with the next
+    // one.
+    m_history_container.back().assign(state.buf, state.len);
+    // Show the next entry.
+    state.history_index += direction ? -1 : 1;
+    if (state.history_index < 0)
+    {
+      state.history_index = 0;
+      return;
+    }
+    else if (state.history_index >= static_cast<int>(size))
+    {
+      state.history_index = size - 1;
+      return;
+    }
+
+    const auto& entry = m_history_container[size - 1 - state.history_index];
+    const auto old_len = state.len;
+
+    std::strncpy(state.buf, entry.c_str(), state.buflen);
+    state.buf[state.buflen - 1] = '\0';
+    state.len = state.pos = std::strlen(state.buf);
+    buffer_changed(state, 0, old_len, state.len);
+    refresh(state);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::delete_next_char(struct state& state)
+  {
+    if (state.len > 0 && state.pos < state.len)
+    {
+      std::memmove(
+        static_cast<void*>(state.buf + state.pos),
+        static_cast<const void*>(state.buf + state.pos + 1),
+        state.len - state.pos - 1
+      );
+      --state.len;
+      state.buf[state.len] = '\0';
+      buffer_changed(state, state.pos, 1, 0);
+      refresh(state);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::delete_previous_char(struct state& state)
+  {
+    if (state.pos > 0 && state.len > 0)
+    {
+      std::memmove(
+        static_cast<void*>(state.buf + state.pos - 1),
+        static_cast<const void*>(state.buf + state.pos),
+        state.len - state.pos
+      );
+      --state.pos;
+      --state.len;
+      state.buf[state.len] = '\0';
+      buffer_changed(state, state.pos, 1, 0);
+      refresh(state);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::delete_previous_word(struct state& state)
+  {
+    const auto old_pos = state.pos;
+    std::size_t diff;
+
+    while (state.pos > 0 && state.buf[state.pos - 1] == ' ')
+    {
+      --state.pos;
+    }
+    while (state.pos > 0 && state.buf[state.pos - 1] != ' ')
+    {
+      --state.pos;
+    }
+    diff = old_pos - state.pos;
+    std::memmove(
+      static_cast<void*>(state.buf + state.pos),
+      static_cast<const void*>(state.buf + old_pos),
+      state.len - old_pos + 1
+    );
+    state.len -= diff;
+    buffer_changed(state, state.pos, diff, 0);
+    refresh(state);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::transpose_characters(struct state& state)
+  {
+    if (state.pos > 0 && state.pos < state.len)
+    {
+      const auto aux = state.buf[state.pos - 1];
+
+      state.buf[state.pos - 1] = state.buf[state.pos];
+      state.buf[state.pos] = aux;
+      buffer_changed(state, state.pos - 1, 2, 2);
+      if (state.pos != state.len - 1)
+      {
+        ++state.pos;
+      }
+      refresh(state);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::kill_line(struct state& state)
+  {
+    const auto start = find_line(state, state.pos).second;
+    const auto diff = state.pos - start;
+
+    std::memmove(
+      static_cast<void*>(state.buf + start),
+      static_cast<const void*>(state.buf + state.pos),
+      state.len - state.pos + 1
+    );
+    state.pos = start;
+    state.len -= diff;
+    buffer_changed(state, state.pos, diff, 0);
+    refresh(state);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::kill_end_of_line(struct state& state)
+  {
+    const auto line = find_line(state, state.pos);
+    const auto end = line.second + state.lines[line.first].length;
+
+    std::memmove(
+      static_cast<void*>(state.buf + state.pos),
+      static_cast<const void*>(state.buf + end),
+      state.len - end + 1
+    );
+    state.len -= end - state.pos;
+    buffer_changed(state, state.pos, end - state.pos, 0);
+    refresh(state);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::handle_esc(struct state& state)
+  {
+    const auto seq = state.seq;
+
+    // ESC [ sequences.
+    if (seq[0] == '[')
+    {
+      if (std::isdigit(seq[1]))
+      {
+        if (seq[2] == '~')
+        {
+          switch (seq[1])
+          {
+            case '3': // Delete key
+              delete_next_char(state);
+              break;
+
+            case '1': // Home (PuTTY)
+              move_home(state);
+              break;
+
+            case '4': // End (PuTTY)
+              move_end(state);
+              break;
+          }
+        }
+      } else {
+        switch (seq[1])
+        {
+          case 'A': // Up
+            move_vertical(state, false);
+            break;
+
+          case 'B': // Down
+            move_vertical(state, true);
+            break;
+
+          case 'C': // Right
+            move_right(state);
+            break;
+
+          case 'D': // Left
+            move_left(state);
+            break;
+
+          case 'H': // Home
+            move_home(state);
+            break;
+
+          case 'F': // End
+            move_end(state);
+            break;
+        }
+      }
+    }
+    // ESC O sequences.
+    else if (seq[0] == 'O')
+    {
+      switch (seq[1])
+      {
+        case 'H': // Home
+          move_home(state);
+          break;
+
+        case 'F': // End
+          move_end(state);
+          break;
+      }
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::start_completion(struct state& state)
+  {
+    auto& completions = state.completions;
+    const auto speculation = find_speculation(state);
+
+    completions.clear();
+    if (speculation != std::end(m_speculations))
+    {
+      const auto result = std::move(speculation->result);
+
+      m_speculations.erase(speculation);
+
+      std::unique_lock<std::mutex> lock(result->mutex);
+
+      result->condition.wait(lock, [&result]() { return result->done; });
+      lock.unlock();
+      result->thread.join();
+      if (result->error)
+      {
+        std::rethrow_exception(result->error);
+      }
+      completions = std::move(result->completions);
+    } else {
+      const trace_scope scope(m_trace.get(), "completion");
+
+      (*m_completion_callback)(get_context(state), completions);
+    }
+    if (m_ranking_limit && !completions.empty())
+    {
+      rank_completions(state, completions, *m_ranking_limit);
+    }
+
+    if (completions.empty())
+    {
+      beep(state);
+    }
+    else if (m_completion_menu && completions.size() > 1 && state.rows != 1)
+    {
+      open_menu(state);
+    } else {
+      state.cycling = true;
+      state.completion_index = 0;
+      show_completion(state);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::show_completion(struct state& state)
+  {
+    const auto& completions = state.completions;
+
+    if (state.completion_index < completions.size())
+    {
+      const std::string saved(state.buf, state.len);
+      const auto saved_pos = state.pos;
+      std::size_t shown;
+
+      set_buffer(state, completions[state.completion_index]);
+      refresh(state);
+      shown = state.len;
+      std::memcpy(state.buf, saved.c_str(), saved.length() + 1);
+      state.len = saved.length();
+      state.pos = saved_pos;
+      buffer_changed(state, 0, shown, state.len);
+    } else {
+      refresh(state);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::cycle_key(struct state& state, char c)
+  {
+    const auto count = state.completions.size();
+    auto& i = state.completion_index;
+
+    if (c == static_cast<int>(key::tab))
+    {
+      i = (i + 1) % (count + 1);
+      if (i == count)
+      {
+        beep(state);
+      }
+      show_completion(state);
+
+      return true;
+    }
+    else if (c == static_cast<int>(key::esc))
+    {
+      // Re-show original buffer.
+      if (i < count)
+      {
+        refresh(state);
+      }
+    }
+    else if (i < count)
+    {
+      // Update buffer with the completion.
+      set_buffer(state, state.completions[i]);
+    }
+    state.cycling = false;
+    state.completions.clear();
+
+    return false;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::set_buffer(struct state& state, std::string_view text)
+  {
+    const auto old_len = state.len;
+
+    state.len = state.pos = std::min(text.length(), state.buflen);
+    std::memcpy(state.buf, text.data(), state.len);
+    state.buf[state.len] = '\0';
+    buffer_changed(state, 0, old_len, state.len);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::rank_completions(const struct state& state,
+                                      completion_container_type& completions,
+                                      std::size_t limit)
+  {
+    // Completions are not worth distributing to other threads in chunks
+    // smaller than this.
+    static const std::size_t min_chunk_size = 4096;
+    const trace_scope scope(m_trace.get(), "ranking");
+    const auto context = get_context(state);
+    const auto current = context.current_token();
+    const auto pattern = current
+      ? context.unquote(context.tokens()[*current])
+      : std::string();
+    const auto strip = current
+      ? context.tokens()[*current].offset
+      : state.pos;
+    const auto count = completions.size();
+    auto& pool = get_thread_pool();
+    const auto chunk_count = std::min(
+      std::max<std::size_t>(pool.size(), 1) * 4,
+      (count + min_chunk_size - 1) / min_chunk_size
+    );
+    const auto chunk_size = (count + chunk_count - 1) / chunk_count;
+    std::vector<std::vector<ranked_completion>> chunks(chunk_count);
+    std::vector<ranked_completion> ranked;
+    completion_container_type result(completions.get_allocator());
+    const auto select = [limit](std::vector<ranked_completion>& matches)
+    {
+      const auto middle = std::begin(matches)
+        + std::min(limit, matches.size());
+
+      std::partial_sort(std::begin(matches), middle, std::end(matches));
+      matches.erase(middle, std::end(matches));
+    };
+    const auto rank_chunk = [&](std::size_t chunk)
+    {
+      const auto end = std::min(count, (chunk + 1) * chunk_size);
+      auto& matches = chunks[chunk];
+
+      for (auto i = chunk * chunk_size; i < end; ++i)
+      {
+        const auto label = get_completion_label(
+          state,
+          completions[i],
+          strip
+        );
+        const auto score = fuzzy_score(pattern, label);
+
+        if (score >= 0)
+        {
+          matches.push_back({ -score, label.length(), i });
+        }
+      }
+      select(matches);
+    };
+
+    if (chunk_count > 1)
+    {
+      pool.run(chunk_count, rank_chunk);
+    }
+    else if (chunk_count == 1)
+    {
+      rank_chunk(0);
+    }
+    for (auto& matches : chunks)
+    {
+      ranked.insert(std::end(ranked), std::begin(matches), std::end(matches));
+    }
+    select(ranked);
+    result.reserve(ranked.size());
+    for (const auto& r : ranked)
+    {
+      result.push_back(std::move(completions[r.index]));
+    }
+    completions.swap(result);
+  }
+
+  PEELO_PROMPT_INLINE
+  int prompt::impl::fuzzy_score(std::string_view pattern, std::string_view text)
+  {
+    const auto lower = [](unsigned char c)
+    {
+      return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    };
+    int score = 0;
+    int streak = 0;
+    std::size_t j = 0;
+
+    for (std::size_t i = 0; i < text.length() && j < pattern.length(); ++i)
+    {
+      const auto c = static_cast<unsigned char>(text[i]);
+      const auto p = static_cast<unsigned char>(pattern[j]);
+
+      if (lower(c) != lower(p))
+      {
+        streak = 0;
+        if (j > 0)
+        {
+          --score;
+        }
+        continue;
+      }
+      score += 1 + 8 * streak++;
+      if (i == 0 || !std::isalnum(static_cast<unsigned char>(text[i - 1])))
+      {
+        score += 8;
+      }
+      if (c == p)
+      {
+        ++score;
+      }
+      ++j;
+    }
+
+    return j < pattern.length() ? -1 : std::max(score, 0);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::open_menu(struct state& state)
+  {
+    const auto context = get_context(state);
+    const auto current = context.current_token();
+    auto& m = m_menu;
+    std::size_t height = std::min<std::size_t>(
+      state.completions.size(),
+      PEELO_PROMPT_COMPLETION_MENU_ROWS
+    );
+
+    // The menu takes the rows below the input, but at least one row of the
+    // input is always shown along with it.
+    if (state.rows > 1)
+    {
+      const auto input_rows = m_multi_line ? m_visible_rows.size() : 1;
+
+      height = std::min(
+        height,
+        input_rows < state.rows ? state.rows - input_rows : 1
+      );
+    }
+    m.height = std::max<std::size_t>(height, 1);
+    if (!m_multi_line)
+    {
+      // Single line mode does not keep track of the cursor.
+      state.cursor_row = 0;
+      state.cursor_col = state.layout.width + state.pos - state.scroll;
+    }
+    else if (state.rows > 0 && m_visible_rows.size() + m.height > state.rows)
+    {
+      // The input fills too much of the screen for the menu to fit below
+      // it, so the viewport is shrunk to make room for the menu.
+      state.menu_rows = m.height;
+      refresh(state, true);
+    }
+    m.bottom = m_multi_line ? m_visible_rows.size() - 1 : 0;
+    m.strip = current ? context.tokens()[*current].offset : state.pos;
+    m.selected = 0;
+    m.page = 0;
+    m.pages.assign(1, 0);
+    layout_menu_page(state, m, 0);
+    state.menu_active = true;
+    draw_menu(state, m);
+  }
+
+  PEELO_PROMPT_INLINE
+  bool prompt::impl::menu_key(struct state& state, char c)
+  {
+    const auto count = state.completions.size();
+    const auto selected = m_menu.selected;
+
+    if (c == static_cast<int>(key::tab))
+    {
+      select_menu_item(state, selected + 1 < count ? selected + 1 : 0);
+
+      return true;
+    }
+    else if (c == static_cast<int>(key::esc))
+    {
+      state.escape = true;
+      state.seq_len = 0;
+
+      return true;
+    }
+
+    clear_menu(state, m_menu);
+    set_buffer(state, state.completions[selected]);
+    state.menu_active = false;
+    state.completions.clear();
+    refresh(state);
+
+    // Enter just accepts the selected completion.
+    return c == static_cast<int>(key::enter);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::menu_escape(struct state& state)
+  {
+    const auto count = state.completions.size();
+    const auto height = m_menu.height;
+    const auto selected = m_menu.selected;
+
+    if (state.seq[0] != '[')
+    {
+      return;
+    }
+    switch (state.seq[1])
+    {
+      case 'A': // Up
+      case 'Z': // Shift-Tab
+        if (selected > 0)
+        {
+          select_menu_item(state, selected - 1);
+        }
+        break;
+
+      case 'B': // Down
+        select_menu_item(state, selected + 1 < count ? selected + 1 : 0);
+        break;
+
+      case 'C': // Right
+        if (selected + height < count)
+        {
+          select_menu_item(state, selected + height);
+        }
+        break;
+
+      case 'D': // Left
+        if (selected >= height)
+        {
+          select_menu_item(state, selected - height);
+        }
+        break;
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::select_menu_item(struct state& state, std::size_t selected)
+  {
+    auto& m = m_menu;
+
+    m.selected = selected;
+    if (selected < m.pages[m.page] || selected >= m.end)
+    {
+      if (selected < m.pages[m.page])
+      {
+        m.page = selected == 0 ? 0 : m.page - 1;
+      }
+      else if (++m.page == m.pages.size())
+      {
+        m.pages.push_back(m.end);
+      }
+      layout_menu_page(state, m, m.pages[m.page]);
+    }
+    draw_menu(state, m);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::close_menu(struct state& state)
+  {
+    const auto menu_rows = state.menu_rows;
+
+    clear_menu(state, m_menu);
+    state.menu_active = false;
+    state.escape = false;
+    state.completions.clear();
+
+    // Give the rows taken by the menu back to the input.
+    if (menu_rows > 0)
+    {
+      refresh(state);
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::layout_menu_page(const struct state& state,
+                                      menu& m,
+                                      std::size_t first) const
+  {
+    const auto& completions = state.completions;
+    // The last column is left empty, to keep the cursor from wrapping.
+    const auto max_width = state.cols > 1 ? state.cols - 1 : 1;
+    std::size_t used = 0;
+
+    m.columns.clear();
+    for (auto start = first; start < completions.size(); start += m.height)
+    {
+      const auto end = std::min(start + m.height, completions.size());
+      std::size_t width = 0;
+
+      for (auto i = start; i < end; ++i)
+      {
+        const auto label = get_completion_label(state, completions[i], m.strip);
+
+        width = std::max(width, append_menu_label(nullptr, label, SIZE_MAX));
+      }
+      width = std::min(width, max_width);
+      if (!m.columns.empty() && used + 2 + width > max_width)
+      {
+        break;
+      }
+      used += (m.columns.empty() ? 0 : 2) + width;
+      m.columns.push_back({ start, width });
+      m.end = end;
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::draw_menu(struct state& state, const menu& m)
+  {
+    const trace_scope scope(m_trace.get(), "frame");
+    const auto& completions = state.completions;
+    auto& buffer = m_frame;
+    std::size_t width = 0;
+
+    buffer.clear();
+    begin_frame(buffer);
+    move_cursor(
+      buffer,
+      state.cols,
+      state.cursor_row,
+      state.cursor_col,
+      m.bottom,
+      state.cursor_col
+    );
+    for (std::size_t row = 0; row < m.height; ++row)
+    {
+      buffer.append("\r\n", 2);
+      width = 0;
+      for (const auto& column : m.columns)
+      {
+        const auto index = column.first + row;
+
+        if (index >= m.end || index >= column.first + m.height)
+        {
+          break;
+        }
+        if (width > 0)
+        {
+          buffer.append(2, ' ');
+          width += 2;
+        }
+        if (index == m.selected)
+        {
+          buffer.append("\033[7m", 4);
+        }
+
+        const auto label_width = append_menu_label(
+          &buffer,
+          get_completion_label(state, completions[index], m.strip),
+          column.width
+        );
+
+        if (index == m.selected)
+        {
+          buffer.append("\033[0m", 4);
+        }
+        if (&column != &m.columns.back())
+        {
+          buffer.append(column.width - label_width, ' ');
+          width += column.width;
+        } else {
+          width += label_width;
+        }
+      }
+      buffer.append("\033[K", 3);
+    }
+    buffer.append("\033[J", 3);
+    move_cursor(
+      buffer,
+      state.cols,
+      m.bottom + m.height,
+      width,
+      state.cursor_row,
+      state.cursor_col
+    );
+    end_frame(buffer);
+    write_frame(state, buffer);
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::clear_menu(struct state& state, const menu& m)
+  {
+    const trace_scope scope(m_trace.get(), "frame");
+    auto& buffer = m_frame;
+
+    buffer.clear();
+    begin_frame(buffer);
+    move_cursor(
+      buffer,
+      state.cols,
+      state.cursor_row,
+      state.cursor_col,
+      m.bottom + 1,
+      0
+    );
+    buffer.append("\033[J", 3);
+    move_cursor(
+      buffer,
+      state.cols,
+      m.bottom + 1,
+      0,
+      state.cursor_row,
+      state.cursor_col
+    );
+    end_frame(buffer);
+    write_frame(state, buffer);
+    state.menu_rows = 0;
+  }
+
+  PEELO_PROMPT_INLINE
+  std::string_view prompt::impl::get_completion_label(
+    const struct state& state,
+    std::string_view completion,
+    std::size_t strip
+  )
+  {
+    std::string_view label(completion);
+
+    if (label.length() >= strip
+        && !label.compare(0, strip, std::string_view(state.buf, strip)))
+    {
+      label.remove_prefix(strip);
+    }
+
+    return label;
+  }
+
+  PEELO_PROMPT_INLINE
+  std::size_t prompt::impl::append_menu_label(frame* buffer,
+                                              std::string_view label,
+                                              std::size_t max_width)
+  {
+    std::size_t width = 0;
+    std::size_t start = 0;
+    std::size_t i = 0;
+
+    for (; i < label.length(); ++i)
+    {
+      const auto c = static_cast<unsigned char>(label[i]);
+
+      if (c < 0x20 || c == 0x7f)
+      {
+        if (buffer)
+        {
+          buffer->append(label.data() + start, i - start);
+        }
+        start = i + 1;
+      }
+      else if ((c & 0xc0) != 0x80)
+      {
+        if (width == max_width)
+        {
+          break;
+        }
+        ++width;
+      }
+    }
+    if (buffer)
+    {
+      buffer->append(label.data() + start, i - start);
+    }
+
+    return width;
+  }
+
+  PEELO_PROMPT_INLINE
+  void prompt::impl::speculate(const struct state& state)
+  {
+    if (!m_speculation_delay
+        || !m_completion_callback
+        || state.cycling
+        || state.menu_active)
+    {
+      return;
+    }
+
+    const auto is_stale = [&](const speculation& s)
+    {
+      return s.version != m_buffer_version || s.pos != state.pos;
+    };
+    const auto delay = std::clamp<std::chrono::milliseconds::rep>(
+      m_speculation_delay->count(),
+      0,
+      std::numeric_limits<int>::max()
+    );
+
+    // Computations for text which has since been edited are canceled, but
+    // not waited for. Their threads keep running until the callback
+    // returns, so they count against the limit until then.
+    for (const auto& s : m_speculations)
+    {
+      if (is_stale(s))
+      {
+        s.result->canceled = true;
+        m_canceled_speculations.push_back(s.result);
+      }
+    }
+    m_speculations.erase(
+      std::remove_if(
+        std::begin(m_speculations),
+        std::end(m_speculations),
+        is_stale
+      ),
+      std::end(m_speculations)
+    );
+    for (auto& result : m_canceled_speculations)
+    {
+      std::unique_lock<std::mutex> lock(result->mutex);
+
+      if (result->done)
+      {
+        lock.unlock();
+        result->thread.join();
+      }
+    }
+    m_canceled_speculations.erase(
+      std::remove_if(
+        std::begin(m_canceled_speculations),
+        std::end(m_canceled_speculations),
+        [](const std::shared_ptr<speculation_result>& result)
+        {
+          return !result->thread.joinable();
+        }
+      ),
+      std::end(m_canceled_speculations)
+    );
+    if (m_speculations.size() + m_canceled_speculations.size()
+        >= m_speculation_limit
+        || find_speculation(state) != std::end(m_speculations)
+        // Sessions are fed by an event loop which must not be blocked, so
+        // they don't wait for the user to stop typing.
+        || (state.ifd >= 0
+            && has_pending_input(state.ifd, static_cast<int>(delay))))
+    {
+      return;
+    }
+    // The thread must be owned by the prompt once started, so that it's
+    // always joined.
+    m_speculations.reserve(m_speculations.size() + 1);
+    try
+    {
+      auto result = std::make_shared<speculation_result>();
+
+      result->thread = std::thread(
+        [
+          result,
+          callback = *m_completion_callback,
+          buffer = std::string(state.buf, state.len),
+          pos = state.pos,
+          tokens = state.tokens,
+          trace = m_trace
+        ]()
+        {
+          const trace_scope scope(trace.get(), "completion");
+          completion_container_type completions;
+          std::exception_ptr error;
+
+          try
+          {
+            callback(
+              input_context(buffer, pos, tokens, &result->canceled),
+              completions
+            );
+          }
+          catch (...)
+          {
+            error = std::current_exception();
+          }
+
+          std::lock_guard<std::mutex> lock(result->mutex);
+
+          result->completions = std::move(completions);
+          result->error = error;
+          result->done = true;
+          result->condition.notify_one();
+        }
+      );
+      m_speculations.push_back({
+        m_buffer_version,
+        state.pos,
+        std::move(result)
+      });
+    }
+    catch (const std::system_error&)
+    {
+      // Completions are computed when tab is pressed instead, if a thread
+      // cannot be started.
+    }
+  }
+
+  PEELO_PROMPT_INLINE
+  std::pmr::vector<prompt::impl::speculation>::iterator
+  prompt::impl::find_speculation(const struct state& state)
+  {
+    return std::find_if(
+      std::begin(m_speculations),
+      std::end(m_speculations),
+      [&](const speculation& s)
+      {
+        return s.version == m_buffer_version && s.pos == state.pos;
+      }
+    );
+  }
+
+  PEELO_PROMPT_INLINE
+  std::size_t prompt::impl::show_hints(std::pmr::string& buffer,
+                                        struct state& state)
+  {
+    const auto plen = state.layout.width;
+    char seq[64];
+    color col = color::none;
+    bool bold = false;
+
+    buffer.clear();
+    if (!m_hints_callback || plen + state.len >= state.cols)
+    {
+      return 0;
+    }
+
+    auto hint = [&]()
+    {
+      const trace_scope scope(m_trace.get(), "hints");
+
+      return (*m_hints_callback)(get_context(state), col, bold);
+    }();
+
+    if (hint)
+    {
+      const auto& value = hint.value();
+      auto hintlen = value.length();
+      auto hintmaxlen = state.cols - (plen + state.len);
+
+      if (hintlen > hintmaxlen)
+      {
+        hintlen = hintmaxlen;
+      }
+      if (bold && col == color::none)
+      {
+        col = color::white;
+      }
+      if (col != color::none || bold)
+      {
+        std::snprintf(
+          seq,
+          64,
+          "\033[%d;%d;49m",
+          bold ? 1 : 0,
+          static_cast<int>(col)
+        );
+      } else {
+        seq[0] = '\0';
+      }
+      buffer.append(seq, std::strlen(seq));
+      buffer.append(value.c_str(), hintlen);
+      if (col != color::none || bold)
+      {
+        buffer.append("\033[0m", 4);
+      }
+
+      return hintlen;
+    }
+
+    return 0;
+  }
+}
+
+#endif /* !PEELO_PROMPT_IPP_GUARD */
@@ -0,0 +1,6 @@
+/*
+ * Compiles the implementation of peelo::prompt into a library, for when it's
+ * not used as header only.
+ */
+#include <peelo/prompt.hpp>
+#include <peelo/prompt.ipp>